@@ -0,0 +1,181 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the QtScxml module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "qscxmlcompiledchart_p.h"
+#include "qscxmlparser.h"
+
+#include <QFile>
+#include <QXmlStreamReader>
+
+QT_BEGIN_NAMESPACE
+
+/*!
+ * \class QScxmlCompiledChart
+ * \brief The QScxmlCompiledChart class holds a parsed and compiled SCXML document, from which
+ * any number of state machines can be instantiated.
+ * \since 5.7
+ * \inmodule QtScxml
+ *
+ * Parsing an SCXML document and generating its executable content is considerably more
+ * expensive than creating a state machine from the result. When the same document is used to
+ * create many state machines, compile it once into a QScxmlCompiledChart and call
+ * instantiateStateMachine() for each instance.
+ *
+ * A compiled chart is immutable and implicitly shared. Copying it is cheap, and it can be used
+ * from multiple threads at the same time. The state machines created from it share the
+ * executable content, the string tables, and the meta object, but each gets its own states,
+ * transitions, and data model.
+ *
+ * \sa QScxmlStateMachine::fromFile() QScxmlParser
+ */
+
+/*!
+ * Creates an empty, invalid compiled chart.
+ */
+QScxmlCompiledChart::QScxmlCompiledChart()
+    : d(new QScxmlCompiledChartPrivate)
+{}
+
+/*!
+ * Constructs a copy of \a other. The compiled data is shared, not copied.
+ */
+QScxmlCompiledChart::QScxmlCompiledChart(const QScxmlCompiledChart &other)
+    : d(other.d)
+{}
+
+/*!
+ * Assigns \a other to this compiled chart and returns a reference to this compiled chart.
+ */
+QScxmlCompiledChart &QScxmlCompiledChart::operator=(const QScxmlCompiledChart &other)
+{
+    d = other.d;
+    return *this;
+}
+
+/*!
+ * Destroys the compiled chart. State machines instantiated from it stay valid.
+ */
+QScxmlCompiledChart::~QScxmlCompiledChart()
+{}
+
+/*!
+ * Reads and compiles the SCXML file specified by \a fileName.
+ *
+ * This method will always return a compiled chart. If errors occur while reading the file, the
+ * chart is not valid, and the errors can be retrieved by calling parseErrors().
+ */
+QScxmlCompiledChart QScxmlCompiledChart::fromFile(const QString &fileName)
+{
+    QFile scxmlFile(fileName);
+    if (!scxmlFile.open(QIODevice::ReadOnly)) {
+        QScxmlCompiledChart chart;
+        QScxmlError err(scxmlFile.fileName(), 0, 0, QStringLiteral("cannot open for reading"));
+        chart.d->errors.append(err);
+        return chart;
+    }
+
+    QScxmlCompiledChart chart = fromData(&scxmlFile, fileName);
+    scxmlFile.close();
+    return chart;
+}
+
+/*!
+ * Reads and compiles an SCXML document from the QIODevice specified by \a data. The \a fileName
+ * is used in error messages, and to resolve relative paths.
+ *
+ * \sa parseErrors()
+ */
+QScxmlCompiledChart QScxmlCompiledChart::fromData(QIODevice *data, const QString &fileName)
+{
+    QXmlStreamReader xmlReader(data);
+    QScxmlParser parser(&xmlReader);
+    parser.setFileName(fileName);
+    parser.parse();
+    return fromParser(parser);
+}
+
+/*!
+ * Compiles the document read by \a parser. QScxmlParser::parse() has to be called before.
+ *
+ * The compiled chart keeps parts of the parsed document alive, but does not depend on the
+ * parser itself.
+ */
+QScxmlCompiledChart QScxmlCompiledChart::fromParser(const QScxmlParser &parser)
+{
+    QScxmlParserPrivate *parserPrivate = QScxmlParserPrivate::get(const_cast<QScxmlParser *>(&parser));
+    return QScxmlCompiledChartPrivate::compile(parserPrivate->scxmlDocument(), parser.errors());
+}
+
+/*!
+ * Returns \c true if the document was compiled without errors, and state machines can be
+ * instantiated from it.
+ */
+bool QScxmlCompiledChart::isValid() const
+{
+    return d->tableData && d->errors.isEmpty();
+}
+
+/*!
+ * Returns the errors that occurred while reading or compiling the document.
+ */
+QVector<QScxmlError> QScxmlCompiledChart::parseErrors() const
+{
+    return d->errors;
+}
+
+/*!
+ * Returns the name of the state machine as set by the \c name attribute of the \c <scxml> tag.
+ */
+QString QScxmlCompiledChart::name() const
+{
+    return d->tableData ? d->tableData->name() : QString();
+}
+
+/*!
+ * Creates a new state machine, including its data model, from the compiled document.
+ *
+ * This method will always return a state machine. If the chart is not valid, the state machine
+ * cannot be started, and QScxmlStateMachine::parseErrors() returns the errors of the chart.
+ */
+QScxmlStateMachine *QScxmlCompiledChart::instantiateStateMachine() const
+{
+    return d->instantiate(true);
+}
+
+QT_END_NAMESPACE
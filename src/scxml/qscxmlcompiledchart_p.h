@@ -0,0 +1,164 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the QtScxml module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef QSCXMLCOMPILEDCHART_P_H
+#define QSCXMLCOMPILEDCHART_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt API.  It exists purely as an
+// implementation detail.  This header file may change from version to
+// version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include "qscxmlcompiledchart.h"
+#include "qscxmlexecutablecontent_p.h"
+#include "qscxmlinvokableservice.h"
+#include "qscxmlparser_p.h"
+
+#include <QSharedData>
+#include <QSharedPointer>
+#include <QStringList>
+
+QT_BEGIN_NAMESPACE
+
+namespace QScxmlInternal {
+class DynamicMetaObject;
+
+// A state to create when instantiating a compiled chart. States are listed in document order, so
+// the parent of a state always comes before it.
+struct CompiledState
+{
+    enum Kind {
+        Normal,
+        Parallel,
+        Initial,
+        Final,
+        ShallowHistory,
+        DeepHistory
+    };
+
+    Kind kind;
+    int parent; // -1 for the state machine itself
+    QString id;
+    QScxmlExecutableContent::ContainerId onEntry;
+    QScxmlExecutableContent::ContainerId onExit;
+    QScxmlExecutableContent::ContainerId initInstructions;
+    QScxmlExecutableContent::ContainerId doneData;
+    QVector<int> invokes; // indexes into the invokes of the chart
+
+    CompiledState()
+        : kind(Normal)
+        , parent(-1)
+        , onEntry(QScxmlExecutableContent::NoInstruction)
+        , onExit(QScxmlExecutableContent::NoInstruction)
+        , initInstructions(QScxmlExecutableContent::NoInstruction)
+        , doneData(QScxmlExecutableContent::NoInstruction)
+    {}
+};
+
+struct CompiledTransition
+{
+    int source; // -1 for the state machine itself
+    bool isHistoryDefault;
+    bool isInternal;
+    QStringList events;
+    QVector<int> targets;
+    QScxmlExecutableContent::EvaluatorId condition;
+    QScxmlExecutableContent::ContainerId instructions;
+
+    CompiledTransition()
+        : source(-1)
+        , isHistoryDefault(false)
+        , isInternal(false)
+        , condition(QScxmlExecutableContent::NoEvaluator)
+        , instructions(QScxmlExecutableContent::NoInstruction)
+    {}
+};
+
+struct CompiledInvoke
+{
+    QScxmlExecutableContent::StringId invokeLocation;
+    QScxmlExecutableContent::StringId id;
+    QScxmlExecutableContent::StringId idPrefix;
+    QScxmlExecutableContent::StringId idLocation;
+    QVector<QScxmlExecutableContent::StringId> namelist;
+    bool autoforward;
+    QVector<QScxmlInvokableServiceFactory::Param> params;
+    QScxmlExecutableContent::ContainerId finalize;
+    QScxmlCompiledChart chart; // compiled once, instantiated for each invocation
+};
+} // QScxmlInternal namespace
+
+// Everything a state machine instance needs, except for the QObject tree of states and
+// transitions and the data model. Once compiled, it is never modified again, so it can be
+// shared between instances and threads.
+class QScxmlCompiledChartPrivate: public QSharedData
+{
+public:
+    QScxmlCompiledChartPrivate()
+        : lateBinding(false)
+        , dataModel(DocumentModel::Scxml::NullDataModel)
+    {}
+
+    static QScxmlCompiledChartPrivate *get(const QScxmlCompiledChart &chart)
+    { return chart.d.data(); }
+
+    static QScxmlCompiledChart compile(DocumentModel::ScxmlDocument *doc,
+                                       const QVector<QScxmlError> &errors);
+    QScxmlStateMachine *instantiate(bool withDataModel) const;
+
+    QVector<QScxmlError> errors;
+    bool lateBinding;
+    DocumentModel::Scxml::DataModelType dataModel;
+    QVector<QScxmlInternal::CompiledState> states;
+    QVector<QScxmlInternal::CompiledTransition> transitions;
+    QVector<QScxmlInternal::CompiledInvoke> invokes;
+    QVector<QPair<int, int> > initialStates; // (parent or -1 for the machine, initial state)
+    QSharedPointer<QScxmlExecutableContent::DynamicTableData> tableData;
+    QSharedPointer<const QScxmlInternal::DynamicMetaObject> metaObject;
+};
+
+QT_END_NAMESPACE
+
+#endif // QSCXMLCOMPILEDCHART_P_H
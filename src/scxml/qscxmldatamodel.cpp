@@ -42,6 +42,10 @@
 #include "qscxmlecmascriptdatamodel.h"
 #include "qscxmlstatemachine_p.h"
 
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+
 QT_BEGIN_NAMESPACE
 
 /*!
@@ -133,6 +137,183 @@ QScxmlTableData *QScxmlDataModel::tableData() const
     return stateMachine()->tableData();
 }
 
+/*!
+ * \enum QScxmlDataModel::ProfileKind
+ *
+ * This enum specifies which kind of evaluator a profile entry belongs to.
+ *
+ * \value EvaluatorProfile An expression evaluated to a string, a boolean, a
+ *        variant, or for its side effects, such as a condition or a script.
+ * \value AssignmentProfile An assignment or a data initialization.
+ * \value ForeachProfile A \c <foreach> loop. The time includes running the
+ *        loop body.
+ */
+
+/*!
+ * \class QScxmlDataModel::ProfileEntry
+ * \inmodule QtScxml
+ * \since 5.7
+ *
+ * \brief The ProfileEntry struct holds the profiling counters of one
+ * evaluator.
+ *
+ * The \c kind and \c id members identify the evaluator in the state
+ * machine's table data. \c callCount and \c failureCount count how often the
+ * evaluator was run and how often it failed. \c totalNanoseconds and
+ * \c maxNanoseconds hold the time spent in it.
+ */
+
+/*!
+ * Returns \c true if the evaluations done by the state machine are profiled.
+ *
+ * \sa setProfiling(), profile()
+ */
+bool QScxmlDataModel::isProfiling() const
+{
+    Q_D(const QScxmlDataModel);
+    return !d->m_profile.isNull();
+}
+
+/*!
+ * Enables profiling if \a profiling is \c true, or disables it otherwise.
+ *
+ * While profiling is enabled, every evaluation the state machine does through
+ * this data model is counted and timed. Disabling profiling discards the
+ * counters collected so far.
+ *
+ * \sa isProfiling(), profile()
+ */
+void QScxmlDataModel::setProfiling(bool profiling)
+{
+    Q_D(QScxmlDataModel);
+    if (profiling == isProfiling())
+        return;
+    d->m_profile.reset(profiling ? new QScxmlDataModelPrivate::Profile : Q_NULLPTR);
+}
+
+/*!
+ * Returns the counters of all evaluators that were run since profiling was
+ * enabled or the profile was last cleared.
+ *
+ * \sa clearProfile(), profileToJson()
+ */
+QVector<QScxmlDataModel::ProfileEntry> QScxmlDataModel::profile() const
+{
+    Q_D(const QScxmlDataModel);
+    QVector<ProfileEntry> entries;
+    if (!d->m_profile)
+        return entries;
+
+    for (int kind = EvaluatorProfile; kind <= ForeachProfile; ++kind) {
+        const QVector<QScxmlDataModelPrivate::Profile::Counters> &counters
+                = d->m_profile->counters[kind];
+        for (int id = 0, ei = counters.size(); id != ei; ++id) {
+            const QScxmlDataModelPrivate::Profile::Counters &c = counters.at(id);
+            if (c.callCount == 0)
+                continue;
+            ProfileEntry entry;
+            entry.kind = ProfileKind(kind);
+            entry.id = id;
+            entry.callCount = c.callCount;
+            entry.failureCount = c.failureCount;
+            entry.totalNanoseconds = c.totalNanoseconds;
+            entry.maxNanoseconds = c.maxNanoseconds;
+            entries.append(entry);
+        }
+    }
+    return entries;
+}
+
+/*!
+ * Resets all profiling counters to zero.
+ */
+void QScxmlDataModel::clearProfile()
+{
+    Q_D(QScxmlDataModel);
+    if (d->m_profile)
+        d->m_profile.reset(new QScxmlDataModelPrivate::Profile);
+}
+
+/*!
+ * Returns the profile as a JSON document. Each entry carries the expression
+ * and the location in the SCXML document of the evaluator it belongs to, so
+ * that slow or failing expressions can be found.
+ *
+ * \sa profile()
+ */
+QByteArray QScxmlDataModel::profileToJson() const
+{
+    using namespace QScxmlExecutableContent;
+
+    QScxmlTableData *td = stateMachine() ? tableData() : Q_NULLPTR;
+    auto str = [td](StringId id) {
+        return td && id != NoString ? td->string(id) : QString();
+    };
+
+    QJsonArray array;
+    foreach (const ProfileEntry &entry, profile()) {
+        QJsonObject object;
+        object.insert(QStringLiteral("id"), entry.id);
+        object.insert(QStringLiteral("calls"), double(entry.callCount));
+        object.insert(QStringLiteral("failures"), double(entry.failureCount));
+        object.insert(QStringLiteral("totalNs"), double(entry.totalNanoseconds));
+        object.insert(QStringLiteral("maxNs"), double(entry.maxNanoseconds));
+
+        switch (entry.kind) {
+        case EvaluatorProfile: {
+            object.insert(QStringLiteral("kind"), QStringLiteral("evaluator"));
+            if (td) {
+                const EvaluatorInfo info = td->evaluatorInfo(entry.id);
+                object.insert(QStringLiteral("expr"), str(info.expr));
+                object.insert(QStringLiteral("context"), str(info.context));
+            }
+            break;
+        }
+        case AssignmentProfile: {
+            object.insert(QStringLiteral("kind"), QStringLiteral("assignment"));
+            if (td) {
+                const AssignmentInfo info = td->assignmentInfo(entry.id);
+                object.insert(QStringLiteral("dest"), str(info.dest));
+                object.insert(QStringLiteral("expr"), str(info.expr));
+                object.insert(QStringLiteral("context"), str(info.context));
+            }
+            break;
+        }
+        case ForeachProfile: {
+            object.insert(QStringLiteral("kind"), QStringLiteral("foreach"));
+            if (td) {
+                const ForeachInfo info = td->foreachInfo(entry.id);
+                object.insert(QStringLiteral("array"), str(info.array));
+                object.insert(QStringLiteral("item"), str(info.item));
+                object.insert(QStringLiteral("index"), str(info.index));
+                object.insert(QStringLiteral("context"), str(info.context));
+            }
+            break;
+        }
+        }
+        array.append(object);
+    }
+    return QJsonDocument(array).toJson();
+}
+
+void QScxmlDataModelPrivate::Profile::record(QScxmlDataModel::ProfileKind kind,
+                                             QScxmlExecutableContent::EvaluatorId id,
+                                             qint64 nanoseconds, bool ok)
+{
+    if (id < 0)
+        return;
+    QVector<Counters> &list = counters[kind];
+    if (id >= list.size())
+        list.resize(id + 1);
+    Counters &c = list[id];
+    ++c.callCount;
+    if (!ok)
+        ++c.failureCount;
+    c.totalNanoseconds += nanoseconds;
+    if (nanoseconds > c.maxNanoseconds)
+        c.maxNanoseconds = nanoseconds;
+}
+
 QScxmlDataModel *QScxmlDataModelPrivate::instantiateDataModel(DocumentModel::Scxml::DataModelType type)
 {
     QScxmlDataModel *dataModel = Q_NULLPTR;
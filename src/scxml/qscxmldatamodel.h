@@ -92,6 +92,28 @@ public:
     virtual bool hasScxmlProperty(const QString &name) const = 0;
     virtual bool setScxmlProperty(const QString &name, const QVariant &value, const QString &context) = 0;
 
+    enum ProfileKind {
+        EvaluatorProfile,
+        AssignmentProfile,
+        ForeachProfile
+    };
+
+    struct ProfileEntry
+    {
+        ProfileKind kind;
+        QScxmlExecutableContent::EvaluatorId id;
+        qint64 callCount;
+        qint64 failureCount;
+        qint64 totalNanoseconds;
+        qint64 maxNanoseconds;
+    };
+
+    bool isProfiling() const;
+    void setProfiling(bool profiling);
+    QVector<ProfileEntry> profile() const;
+    void clearProfile();
+    QByteArray profileToJson() const;
+
 Q_SIGNALS:
     void stateMachineChanged(QScxmlStateMachine *stateMachine);
 
@@ -55,17 +55,137 @@
 #include "qscxmlparser_p.h"
 #include <private/qobject_p.h>
 
+#include <QElapsedTimer>
+#include <QScopedPointer>
+
 QT_BEGIN_NAMESPACE
 
 class QScxmlDataModelPrivate : public QObjectPrivate
 {
+    Q_DECLARE_PUBLIC(QScxmlDataModel)
+
 public:
+    // Counters for each evaluator, indexed by kind and ID.
+    struct Profile
+    {
+        struct Counters
+        {
+            Counters() : callCount(0), failureCount(0), totalNanoseconds(0), maxNanoseconds(0) {}
+
+            qint64 callCount;
+            qint64 failureCount;
+            qint64 totalNanoseconds;
+            qint64 maxNanoseconds;
+        };
+
+        void record(QScxmlDataModel::ProfileKind kind, QScxmlExecutableContent::EvaluatorId id,
+                    qint64 nanoseconds, bool ok);
+
+        QVector<Counters> counters[QScxmlDataModel::ForeachProfile + 1];
+    };
+
+    // Times the evaluation that runs while it is in scope.
+    class ProfileScope
+    {
+    public:
+        ProfileScope(Profile *profile, QScxmlDataModel::ProfileKind kind,
+                     QScxmlExecutableContent::EvaluatorId id, bool *ok)
+            : m_profile(profile), m_kind(kind), m_id(id), m_ok(ok)
+        { m_timer.start(); }
+
+        ~ProfileScope()
+        { m_profile->record(m_kind, m_id, m_timer.nsecsElapsed(), *m_ok); }
+
+    private:
+        Profile *m_profile;
+        QScxmlDataModel::ProfileKind m_kind;
+        QScxmlExecutableContent::EvaluatorId m_id;
+        bool *m_ok;
+        QElapsedTimer m_timer;
+    };
+
     QScxmlDataModelPrivate() : m_stateMachine(Q_NULLPTR) {}
 
+    static QScxmlDataModelPrivate *get(QScxmlDataModel *dataModel)
+    { return static_cast<QScxmlDataModelPrivate *>(QObjectPrivate::get(dataModel)); }
+
     static QScxmlDataModel *instantiateDataModel(DocumentModel::Scxml::DataModelType type);
 
+    // Discards everything set up by QScxmlDataModel::setup(), so that the state machine can be
+    // started again from scratch. Returns false if the data model does not support this.
+    virtual bool reset()
+    { return false; }
+
+    // The interpreter evaluates through these, so that the profile is kept for any data model.
+    // Without profiling, they only add a null check.
+    QString evaluateToString(QScxmlExecutableContent::EvaluatorId id, bool *ok)
+    {
+        Q_Q(QScxmlDataModel);
+        if (!m_profile)
+            return q->evaluateToString(id, ok);
+        ProfileScope scope(m_profile.data(), QScxmlDataModel::EvaluatorProfile, id, ok);
+        return q->evaluateToString(id, ok);
+    }
+
+    bool evaluateToBool(QScxmlExecutableContent::EvaluatorId id, bool *ok)
+    {
+        Q_Q(QScxmlDataModel);
+        if (!m_profile)
+            return q->evaluateToBool(id, ok);
+        ProfileScope scope(m_profile.data(), QScxmlDataModel::EvaluatorProfile, id, ok);
+        return q->evaluateToBool(id, ok);
+    }
+
+    QVariant evaluateToVariant(QScxmlExecutableContent::EvaluatorId id, bool *ok)
+    {
+        Q_Q(QScxmlDataModel);
+        if (!m_profile)
+            return q->evaluateToVariant(id, ok);
+        ProfileScope scope(m_profile.data(), QScxmlDataModel::EvaluatorProfile, id, ok);
+        return q->evaluateToVariant(id, ok);
+    }
+
+    void evaluateToVoid(QScxmlExecutableContent::EvaluatorId id, bool *ok)
+    {
+        Q_Q(QScxmlDataModel);
+        if (!m_profile)
+            return q->evaluateToVoid(id, ok);
+        ProfileScope scope(m_profile.data(), QScxmlDataModel::EvaluatorProfile, id, ok);
+        q->evaluateToVoid(id, ok);
+    }
+
+    void evaluateAssignment(QScxmlExecutableContent::EvaluatorId id, bool *ok)
+    {
+        Q_Q(QScxmlDataModel);
+        if (!m_profile)
+            return q->evaluateAssignment(id, ok);
+        ProfileScope scope(m_profile.data(), QScxmlDataModel::AssignmentProfile, id, ok);
+        q->evaluateAssignment(id, ok);
+    }
+
+    void evaluateInitialization(QScxmlExecutableContent::EvaluatorId id, bool *ok)
+    {
+        Q_Q(QScxmlDataModel);
+        if (!m_profile)
+            return q->evaluateInitialization(id, ok);
+        ProfileScope scope(m_profile.data(), QScxmlDataModel::AssignmentProfile, id, ok);
+        q->evaluateInitialization(id, ok);
+    }
+
+    // The time includes running the loop body.
+    bool evaluateForeach(QScxmlExecutableContent::EvaluatorId id, bool *ok,
+                         QScxmlDataModel::ForeachLoopBody *body)
+    {
+        Q_Q(QScxmlDataModel);
+        if (!m_profile)
+            return q->evaluateForeach(id, ok, body);
+        ProfileScope scope(m_profile.data(), QScxmlDataModel::ForeachProfile, id, ok);
+        return q->evaluateForeach(id, ok, body);
+    }
+
 public:
     QScxmlStateMachine *m_stateMachine;
+    QScopedPointer<Profile> m_profile; // only set while profiling
 };
 
 QT_END_NAMESPACE
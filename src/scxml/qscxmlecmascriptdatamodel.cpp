@@ -45,8 +45,11 @@
 #include "qscxmldatamodel_p.h"
 
 #include <QJSEngine>
-#include <QJsonDocument>
 #include <QtQml/private/qjsvalue_p.h>
+#include <QtQml/private/qv4arrayobject_p.h>
+#include <QtQml/private/qv4context_p.h>
+#include <QtQml/private/qv4persistent_p.h>
+#include <QtQml/private/qv4script_p.h>
 #include <QtQml/private/qv4scopedvalue_p.h>
 
 #include <functional>
@@ -67,48 +70,131 @@ class QScxmlEcmaScriptDataModelPrivate : public QScxmlDataModelPrivate
 public:
     QScxmlEcmaScriptDataModelPrivate()
         : jsEngine(Q_NULLPTR)
+        , ownsEngine(false)
+        , eventProperties(Q_NULLPTR)
     {}
 
-    QString evalStr(const QString &expr, const QString &context, bool *ok)
+    ~QScxmlEcmaScriptDataModelPrivate()
     {
-        QString script = QStringLiteral("(%1).toString()").arg(expr);
-        QJSValue v = eval(script, context, ok);
-        if (*ok)
-            return v.toString();
-        else
-            return QString();
+        qDeleteAll(compiledScripts);
     }
 
-    bool evalBool(const QString &expr, const QString &context, bool *ok)
+    enum FunctionKind {
+        BoolFunction,
+        StringFunction,
+        VariantFunction,
+        AssignmentFunction,
+        FunctionKindCount
+    };
+
+    // A variable of the data model, resolved to its place in the global object. The identifier is
+    // created once. The place is valid as long as the global object keeps the same internal class,
+    // which only changes when variables are added or removed.
+    struct PropertySlot
     {
-        QString script = QStringLiteral("(function(){return !!(%1); })()").arg(expr);
-        QJSValue v = eval(script, context, ok);
-        if (*ok)
-            return v.toBool();
-        else
-            return false;
+        PropertySlot() : internalClass(Q_NULLPTR), index(UINT_MAX) {}
+
+        QV4::PersistentValue identifier;
+        QV4::InternalClass *internalClass;
+        uint index;
+    };
+
+    QJSValue compiledFunction(FunctionKind kind, qint32 id, const QString &expr)
+    {
+        QHash<qint32, QJSValue> &cache = compiledFunctions[kind];
+        QHash<qint32, QJSValue>::const_iterator it = cache.constFind(id);
+        if (it != cache.constEnd())
+            return *it;
+
+        QString script;
+        switch (kind) {
+        case BoolFunction:
+            script = QStringLiteral("(function(){'use strict'; return !!(\n%1\n); })");
+            break;
+        case StringFunction:
+            script = QStringLiteral("(function(){'use strict'; return (\n%1\n).toString(); })");
+            break;
+        case VariantFunction:
+        case AssignmentFunction:
+            script = QStringLiteral("(function(){'use strict'; return (\n%1\n); })");
+            break;
+        default:
+            Q_UNREACHABLE();
+        }
+
+        // A syntax error is cached as well, and reported each time the expression is evaluated.
+        QJSValue function = engine()->evaluate(script.arg(expr), QStringLiteral("<expr>"), 0);
+        cache.insert(id, function);
+        return function;
     }
 
-    QJSValue evalJSValue(const QString &expr, const QString &context, bool *ok)
+    QJSValue call(FunctionKind kind, qint32 id, StringId expr, StringId context, bool *ok)
     {
+        Q_ASSERT(ok);
         Q_ASSERT(engine());
 
-        QString script = QStringLiteral("(function(){'use strict'; return (\n%1\n); })()").arg(expr);
-        return eval(script, context, ok);
+        QJSValue function = compiledFunction(kind, id, string(expr));
+        QJSValue v = function.isCallable() ? function.call() : function;
+        if (v.isError()) {
+            *ok = false;
+            submitError(QStringLiteral("error.execution"),
+                        QStringLiteral("%1 in %2").arg(v.toString(), string(context)));
+            return QJSValue(QJSValue::UndefinedValue);
+        } else {
+            *ok = true;
+            return v;
+        }
     }
 
-    QJSValue eval(const QString &script, const QString &context, bool *ok)
+    QJSValue call(FunctionKind kind, EvaluatorId id, bool *ok)
+    {
+        Q_Q(QScxmlEcmaScriptDataModel);
+        const EvaluatorInfo &info = q->tableData()->evaluatorInfo(id);
+        return call(kind, id, info.expr, info.context, ok);
+    }
+
+    // Runs a <script>. Each one is compiled once, at the first run, and the compiled code is kept
+    // until the engine changes. Like QJSEngine::evaluate(), this compiles the script as global code
+    // and runs it in the global context, so that variables declared by the script are visible to
+    // all later scripts and expressions.
+    QJSValue runScript(EvaluatorId id, StringId expr, StringId context, bool *ok)
     {
         Q_ASSERT(ok);
         Q_ASSERT(engine());
 
-        // TODO: copy QJSEngine::evaluate and handle the case of v4->catchException() "our way"
+        QV4::ExecutionEngine *v4 = QJSValuePrivate::engine(&dataModel);
+        Q_ASSERT(v4);
+        QV4::Scope scope(v4);
+        QV4::ExecutionContextSaver saver(scope);
+        if (v4->currentContext->d() != v4->rootContext()->d())
+            v4->pushGlobalContext();
+        QV4::ScopedValue result(scope);
+
+        QV4::Script *script = compiledScripts.value(id);
+        if (!script) {
+            script = new QV4::Script(v4, Q_NULLPTR, QStringLiteral("'use strict'; ") + string(expr),
+                                     QStringLiteral("<expr>"), 0);
+            // This constructor is meant for QML bindings; a <script> is plain global code.
+            script->parseAsBinding = false;
+            script->inheritContext = true;
+            script->parse();
+            // A script with a syntax error is not kept, so that the error is reported each time.
+            if (v4->hasException)
+                delete script;
+            else
+                compiledScripts.insert(id, script);
+        }
+
+        if (!v4->hasException)
+            result = script->run();
+        if (v4->hasException)
+            result = v4->catchException();
 
-        QJSValue v = engine()->evaluate(QStringLiteral("'use strict'; ") + script, QStringLiteral("<expr>"), 0);
+        QJSValue v(v4, result->asReturnedValue());
         if (v.isError()) {
             *ok = false;
             submitError(QStringLiteral("error.execution"),
-                        QStringLiteral("%1 in %2").arg(v.toString(), context));
+                        QStringLiteral("%1 in %2").arg(v.toString(), string(context)));
             return QJSValue(QJSValue::UndefinedValue);
         } else {
             *ok = true;
@@ -150,55 +236,31 @@ public:
         if (event.name().isEmpty())
             return;
 
-        QJSValue _event = engine()->newObject();
-        QJSValue dataValue = eventDataAsJSValue(event.data());
-        _event.setProperty(QStringLiteral("data"), dataValue.isUndefined() ? QJSValue(QJSValue::UndefinedValue)
-                                                                           : dataValue);
-        _event.setProperty(QStringLiteral("invokeid"), event.invokeId().isEmpty() ? QJSValue(QJSValue::UndefinedValue)
-                                                                                  : engine()->toScriptValue(event.invokeId()));
-        if (!event.originType().isEmpty())
-            _event.setProperty(QStringLiteral("origintype"), engine()->toScriptValue(event.originType()));
-        _event.setProperty(QStringLiteral("origin"), event.origin().isEmpty() ? QJSValue(QJSValue::UndefinedValue)
-                                                                              : engine()->toScriptValue(event.origin()) );
-        _event.setProperty(QStringLiteral("sendid"), event.sendId().isEmpty() ? QJSValue(QJSValue::UndefinedValue)
-                                                                              : engine()->toScriptValue(event.sendId()));
-        _event.setProperty(QStringLiteral("type"), engine()->toScriptValue(event.scxmlType()));
-        _event.setProperty(QStringLiteral("name"), engine()->toScriptValue(event.name()));
-        _event.setProperty(QStringLiteral("raw"), QStringLiteral("unsupported")); // See test178
-        if (event.isErrorEvent())
-            _event.setProperty(QStringLiteral("errorMessage"), event.errorMessage());
-
-        setReadonlyProperty(&dataModel, QStringLiteral("_event"), _event);
-    }
-
-    QJSValue eventDataAsJSValue(const QVariant &eventData) const
-    {
-        if (!eventData.isValid()) {
-            return QJSValue(QJSValue::UndefinedValue);
+        // _event is defined once per engine, as a read-only getter. Later events only replace
+        // what the getter returns, and nothing is converted until a script reads it.
+        if (!eventProperties) {
+            eventProperties = QScxmlEventProperties::create(engine());
+            QJSValue define = engine()->evaluate(QStringLiteral(
+                    "(function(global, properties) {"
+                    "    Object.defineProperty(global, '_event', {"
+                    "        get: function() { return properties.current(); }, enumerable: true"
+                    "    });"
+                    "})"));
+            define.call(QJSValueList() << dataModel << eventProperties->jsValue());
         }
 
-        if (eventData.canConvert<QVariantMap>()) {
-            auto keyValues = eventData.value<QVariantMap>();
-            auto data = engine()->newObject();
-
-            for (QVariantMap::const_iterator it = keyValues.begin(), eit = keyValues.end(); it != eit; ++it) {
-                data.setProperty(it.key(), engine()->toScriptValue(it.value()));
-            }
-
-            return data;
-        }
-
-        if (eventData == QVariant(QMetaType::VoidStar, 0)) {
-            return QJSValue(QJSValue::NullValue);
+        bool parseJson = true;
+        switch (stateMachine()->jsonDataParsing()) {
+        case QScxmlStateMachine::ParseAllJsonData:
+            break;
+        case QScxmlStateMachine::ParseMarkedJsonData:
+            parseJson = event.isJsonData();
+            break;
+        case QScxmlStateMachine::ParseNoJsonData:
+            parseJson = false;
+            break;
         }
-
-        QString data = eventData.toString();
-        QJsonParseError err;
-        QJsonDocument doc = QJsonDocument::fromJson(data.toUtf8(), &err);
-        if (err.error == QJsonParseError::NoError)
-            return engine()->toScriptValue(doc.toVariant());
-        else
-            return engine()->toScriptValue(data);
+        eventProperties->setEvent(event, parseJson);
     }
 
     QScxmlStateMachine *stateMachine() const
@@ -211,13 +273,39 @@ public:
     {
         if (jsEngine == Q_NULLPTR) {
             jsEngine = new QJSEngine(stateMachine());
+            ownsEngine = true;
         }
 
         return jsEngine;
     }
 
     void setEngine(QJSEngine *engine)
-    { jsEngine = engine; }
+    {
+        jsEngine = engine;
+        ownsEngine = false;
+        eventProperties = Q_NULLPTR; // owned by the engine
+        propertySlots.clear();
+        validForeachItems.clear();
+        qDeleteAll(compiledScripts);
+        compiledScripts.clear();
+        for (int i = 0; i < FunctionKindCount; ++i)
+            compiledFunctions[i].clear();
+    }
+
+    bool reset() Q_DECL_OVERRIDE
+    {
+        // The global object cannot be cleaned up reliably, as the system variables are read-only.
+        // Start over with a new engine instead, unless the engine was provided by the user.
+        if (jsEngine && !ownsEngine)
+            return false;
+
+        // Release all values before the engine they live in.
+        QJSEngine *oldEngine = jsEngine;
+        dataModel = QJSValue();
+        setEngine(Q_NULLPTR);
+        delete oldEngine;
+        return true;
+    }
 
     QString string(StringId id) const
     {
@@ -229,15 +317,33 @@ public:
     { return stateMachine()->dataBinding(); }
 
     bool hasProperty(const QString &name) const
-    { return dataModel.hasProperty(name); }
+    {
+        if (cachedPropertyValue(name))
+            return true;
+        return dataModel.hasProperty(name);
+    }
 
     QJSValue property(const QString &name) const
-    { return dataModel.property(name); }
+    {
+        if (const QV4::Value *v = cachedPropertyValue(name))
+            return QJSValue(QJSValuePrivate::engine(&dataModel), v->asReturnedValue());
+        return dataModel.property(name);
+    }
 
     bool setProperty(const QString &name, const QJSValue &value, const QString &context)
+    {
+        QV4::ExecutionEngine *engine = QJSValuePrivate::engine(&dataModel);
+        Q_ASSERT(engine);
+        QV4::Scope scope(engine);
+        QV4::ScopedValue v(scope, QJSValuePrivate::convertedToValue(engine, value));
+        return setProperty(name, propertySlot(engine, name), v, context);
+    }
+
+    bool setProperty(const QString &name, PropertySlot *slot, const QV4::Value &value,
+                     const QString &context)
     {
         QString msg;
-        switch (setProperty(&dataModel, name, value)) {
+        switch (setDataModelProperty(name, slot, value)) {
         case SetPropertySucceeded:
             return true;
         case SetReadOnlyPropertyFailed:
@@ -265,6 +371,81 @@ public:
 public:
     QStringList initialDataNames;
 
+    bool runForeach(EvaluatorId id, const ForeachInfo &info, bool *ok,
+                    QScxmlDataModel::ForeachLoopBody *body)
+    {
+        const QString context = string(info.context);
+        QJSValue jsArray = property(string(info.array));
+        if (!jsArray.isArray()) {
+            submitError(QStringLiteral("error.execution"), QStringLiteral("invalid array '%1' in %2").arg(string(info.array), context));
+            *ok = false;
+            return false;
+        }
+
+        // Whether the item is a valid variable name only depends on the <foreach>, so check it
+        // once.
+        const QString item = string(info.item);
+        QHash<EvaluatorId, bool>::const_iterator valid = validForeachItems.constFind(id);
+        if (valid == validForeachItems.constEnd()) {
+            valid = validForeachItems.insert(id, !engine()->evaluate(
+                    QStringLiteral("(function(){var %1 = 0})()").arg(item)).isError());
+        }
+        if (!*valid) {
+            submitError(QStringLiteral("error.execution"), QStringLiteral("invalid item '%1' in %2")
+                        .arg(item, context));
+            *ok = false;
+            return false;
+        }
+
+        QV4::ExecutionEngine *v4 = QJSValuePrivate::engine(&dataModel);
+        QV4::Scope scope(v4);
+        QV4::ScopedObject array(scope, QJSValuePrivate::convertedToValue(v4, jsArray));
+        Q_ASSERT(array);
+
+        // The loop runs over a shallow copy of the array, so that the body cannot change it.
+        // The copy lives on the JS heap; the JS stack is far too small for big arrays.
+        const uint length = array->getLength();
+        QV4::ScopedArrayObject items(scope, v4->newArrayObject());
+        QV4::ScopedValue itemValue(scope);
+        for (uint i = 0; i < length && !v4->hasException; ++i) {
+            itemValue = array->getIndexed(i);
+            items->arraySet(i, itemValue);
+        }
+        if (v4->hasException) {
+            QJSValue error(v4, v4->catchException());
+            submitError(QStringLiteral("error.execution"),
+                        QStringLiteral("%1 in %2").arg(error.toString(), context));
+            *ok = false;
+            return false;
+        }
+
+        const QString index = string(info.index);
+        PropertySlot *itemSlot = propertySlot(v4, item);
+        PropertySlot *indexSlot = index.isEmpty() ? Q_NULLPTR : propertySlot(v4, index);
+        QV4::ScopedValue indexValue(scope);
+
+        for (uint i = 0; i < length; ++i) {
+            itemValue = items->getIndexed(i);
+            *ok = setProperty(item, itemSlot, itemValue, context);
+            if (!*ok)
+                return false;
+            if (!itemSlot) // the first iteration may have declared it
+                itemSlot = propertySlot(v4, item);
+            if (!index.isEmpty()) {
+                indexValue = QV4::Primitive::fromUInt32(i);
+                *ok = setProperty(index, indexSlot, indexValue, context);
+                if (!*ok)
+                    return false;
+                if (!indexSlot)
+                    indexSlot = propertySlot(v4, index);
+            }
+            if (!body->run())
+                return false;
+        }
+
+        return true;
+    }
+
 private: // Uses private API
     static void setReadonlyProperty(QJSValue *object, const QString& name, const QJSValue& value)
     {
@@ -303,30 +484,107 @@ private: // Uses private API
         SetPropertyFailedForAnotherReason,
     };
 
-    static SetPropertyResult setProperty(QJSValue *object, const QString& name, const QJSValue& value)
+    PropertySlot *propertySlot(QV4::ExecutionEngine *engine, const QString &name) const
     {
-        QV4::ExecutionEngine *engine = QJSValuePrivate::engine(object);
+        QHash<QString, PropertySlot>::iterator it = propertySlots.find(name);
+        if (it != propertySlots.end())
+            return &*it;
+
+        QV4::Scope scope(engine);
+        QV4::ScopedObject o(scope, QJSValuePrivate::getValue(&dataModel));
+        if (!o)
+            return Q_NULLPTR;
+        QV4::ScopedString s(scope, engine->newString(name));
+        if (s->asArrayIndex() < UINT_MAX)
+            return Q_NULLPTR;
+        // Only existing variables get a slot, so that looking up arbitrary names does not make
+        // the cache grow. Everything else takes the uncached path.
+        if (o->internalClass()->find(s) == UINT_MAX)
+            return Q_NULLPTR;
+        s->makeIdentifier(engine);
+
+        PropertySlot &slot = propertySlots[name];
+        slot.identifier.set(engine, s->asReturnedValue());
+        return &slot;
+    }
+
+    // Updates the place of the slot in o, and returns the attributes of the variable.
+    static QV4::PropertyAttributes resolve(QV4::ExecutionEngine *engine, PropertySlot *slot,
+                                           QV4::Object *o)
+    {
+        QV4::InternalClass *ic = o->internalClass();
+        QV4::Scope scope(engine);
+        QV4::ScopedString s(scope, slot->identifier.value());
+        const uint index = ic->find(s);
+        QV4::PropertyAttributes attrs;
+        if (index < UINT_MAX)
+            attrs = ic->propertyData.at(index);
+
+        // Accessors need the generic path.
+        const bool usable = index < UINT_MAX && !attrs.isAccessor();
+        slot->internalClass = usable ? ic : Q_NULLPTR;
+        slot->index = usable ? index : UINT_MAX;
+        return attrs;
+    }
+
+    // Returns the value of a plain variable of the data model, or nullptr if it has none.
+    const QV4::Value *cachedPropertyValue(const QString &name) const
+    {
+        QV4::ExecutionEngine *engine = QJSValuePrivate::engine(&dataModel);
+        if (!engine)
+            return Q_NULLPTR;
+        QV4::Scope scope(engine);
+        QV4::ScopedObject o(scope, QJSValuePrivate::getValue(&dataModel));
+        if (!o)
+            return Q_NULLPTR;
+        PropertySlot *slot = propertySlot(engine, name);
+        if (!slot)
+            return Q_NULLPTR;
+        if (slot->internalClass != o->internalClass())
+            resolve(engine, slot, o);
+        return slot->internalClass ? o->propertyData(slot->index) : Q_NULLPTR;
+    }
+
+    SetPropertyResult setDataModelProperty(const QString &name, PropertySlot *slot,
+                                           const QV4::Value &value)
+    {
+        QV4::ExecutionEngine *engine = QJSValuePrivate::engine(&dataModel);
         Q_ASSERT(engine);
         if (engine->hasException)
             return SetPropertyFailedForAnotherReason;
 
         QV4::Scope scope(engine);
-        QV4::ScopedObject o(scope, QJSValuePrivate::getValue(object));
+        QV4::ScopedObject o(scope, QJSValuePrivate::getValue(&dataModel));
         if (o == Q_NULLPTR) {
             return SetPropertyFailedForAnotherReason;
         }
 
-        QV4::ScopedString s(scope, engine->newString(name));
-        uint idx = s->asArrayIndex();
-        if (idx < UINT_MAX) {
-            Q_UNIMPLEMENTED();
-            return SetPropertyFailedForAnotherReason;
+        QV4::ScopedString s(scope);
+        QV4::PropertyAttributes attrs;
+        if (slot) {
+            // Fast path: a writable variable that was resolved before.
+            if (slot->internalClass == o->internalClass()
+                    && o->internalClass()->propertyData.at(slot->index).isWritable()) {
+                *o->propertyData(slot->index) = value;
+                return SetPropertySucceeded;
+            }
+
+            attrs = resolve(engine, slot, o);
+            s = slot->identifier.value();
+        } else {
+            s = engine->newString(name);
+            if (s->asArrayIndex() < UINT_MAX) {
+                Q_UNIMPLEMENTED();
+                return SetPropertyFailedForAnotherReason;
+            }
+            const uint index = o->internalClass()->find(s);
+            if (index < UINT_MAX)
+                attrs = o->internalClass()->propertyData.at(index);
         }
 
-        QV4::PropertyAttributes attrs = o->query(s);
-        if (attrs.isWritable() || attrs.isEmpty()) {
-            QV4::ScopedValue v(scope, QJSValuePrivate::convertedToValue(engine, value));
-            o->insertMember(s, v);
+        // Accessors are used for system variables like _event, which cannot be assigned to.
+        if (!attrs.isAccessor() && (attrs.isWritable() || attrs.isEmpty())) {
+            o->insertMember(s, value);
             if (engine->hasException) {
                 engine->catchException();
                 return SetPropertyFailedForAnotherReason;
@@ -340,7 +598,13 @@ private: // Uses private API
 
 private:
     mutable QJSEngine *jsEngine;
+    mutable bool ownsEngine;
     QJSValue dataModel;
+    QScxmlEventProperties *eventProperties;
+    mutable QHash<QString, PropertySlot> propertySlots;
+    QHash<EvaluatorId, bool> validForeachItems;
+    QHash<EvaluatorId, QV4::Script *> compiledScripts;
+    QHash<qint32, QJSValue> compiledFunctions[FunctionKindCount];
 };
 
 /*!
@@ -400,25 +664,21 @@ bool QScxmlEcmaScriptDataModel::setup(const QVariantMap &initialDataValues)
 QString QScxmlEcmaScriptDataModel::evaluateToString(EvaluatorId id, bool *ok)
 {
     Q_D(QScxmlEcmaScriptDataModel);
-    const EvaluatorInfo &info = tableData()->evaluatorInfo(id);
-
-    return d->evalStr(d->string(info.expr), d->string(info.context), ok);
+    QJSValue v = d->call(QScxmlEcmaScriptDataModelPrivate::StringFunction, id, ok);
+    return *ok ? v.toString() : QString();
 }
 
 bool QScxmlEcmaScriptDataModel::evaluateToBool(EvaluatorId id, bool *ok)
 {
     Q_D(QScxmlEcmaScriptDataModel);
-    const EvaluatorInfo &info = tableData()->evaluatorInfo(id);
-
-    return d->evalBool(d->string(info.expr), d->string(info.context), ok);
+    QJSValue v = d->call(QScxmlEcmaScriptDataModelPrivate::BoolFunction, id, ok);
+    return *ok ? v.toBool() : false;
 }
 
 QVariant QScxmlEcmaScriptDataModel::evaluateToVariant(EvaluatorId id, bool *ok)
 {
     Q_D(QScxmlEcmaScriptDataModel);
-    const EvaluatorInfo &info = tableData()->evaluatorInfo(id);
-
-    return d->evalJSValue(d->string(info.expr), d->string(info.context), ok).toVariant();
+    return d->call(QScxmlEcmaScriptDataModelPrivate::VariantFunction, id, ok).toVariant();
 }
 
 void QScxmlEcmaScriptDataModel::evaluateToVoid(EvaluatorId id, bool *ok)
@@ -426,7 +686,7 @@ void QScxmlEcmaScriptDataModel::evaluateToVoid(EvaluatorId id, bool *ok)
     Q_D(QScxmlEcmaScriptDataModel);
     const EvaluatorInfo &info = tableData()->evaluatorInfo(id);
 
-    d->eval(d->string(info.expr), d->string(info.context), ok);
+    d->runScript(id, info.expr, info.context, ok);
 }
 
 void QScxmlEcmaScriptDataModel::evaluateAssignment(EvaluatorId id, bool *ok)
@@ -439,7 +699,8 @@ void QScxmlEcmaScriptDataModel::evaluateAssignment(EvaluatorId id, bool *ok)
     QString dest = d->string(info.dest);
 
     if (hasScxmlProperty(dest)) {
-        QJSValue v = d->evalJSValue(d->string(info.expr), d->string(info.context), ok);
+        QJSValue v = d->call(QScxmlEcmaScriptDataModelPrivate::AssignmentFunction, id,
+                             info.expr, info.context, ok);
         if (*ok)
             *ok = d->setProperty(dest, v, d->string(info.context));
     } else {
@@ -467,43 +728,7 @@ bool QScxmlEcmaScriptDataModel::evaluateForeach(EvaluatorId id, bool *ok, Foreac
     Q_D(QScxmlEcmaScriptDataModel);
     Q_ASSERT(ok);
     Q_ASSERT(body);
-    const ForeachInfo &info = tableData()->foreachInfo(id);
-
-    QJSValue jsArray = d->property(d->string(info.array));
-    if (!jsArray.isArray()) {
-        d->submitError(QStringLiteral("error.execution"), QStringLiteral("invalid array '%1' in %2").arg(d->string(info.array), d->string(info.context)));
-        *ok = false;
-        return false;
-    }
-
-    QString item = d->string(info.item);
-    if (engine()->evaluate(QStringLiteral("(function(){var %1 = 0})()").arg(item)).isError()) {
-        d->submitError(QStringLiteral("error.execution"), QStringLiteral("invalid item '%1' in %2")
-                      .arg(d->string(info.item), d->string(info.context)));
-        *ok = false;
-        return false;
-    }
-
-    const int length = jsArray.property(QStringLiteral("length")).toInt();
-    QString idx = d->string(info.index);
-    QString context = d->string(info.context);
-    const bool hasIndex = !idx.isEmpty();
-
-    for (int currentIndex = 0; currentIndex < length; ++currentIndex) {
-        QJSValue currentItem = jsArray.property(static_cast<quint32>(currentIndex));
-        *ok = d->setProperty(item, currentItem, context);
-        if (!*ok)
-            return false;
-        if (hasIndex) {
-            *ok = d->setProperty(idx, currentIndex, context);
-            if (!*ok)
-                return false;
-        }
-        if (!body->run())
-            return false;
-    }
-
-    return true;
+    return d->runForeach(id, tableData()->foreachInfo(id), ok, body);
 }
 
 /*!
@@ -41,6 +41,7 @@
 #include "qscxmlstatemachine.h"
 
 #include <QJSEngine>
+#include <QJsonDocument>
 
 QT_BEGIN_NAMESPACE
 class QScxmlPlatformProperties::Data
@@ -98,4 +99,156 @@ bool QScxmlPlatformProperties::In(const QString &stateName)
     return stateMachine()->isActive(stateName);
 }
 
+class QScxmlEventProperties::Data
+{
+public:
+    Data()
+        : m_parseJson(true)
+    {}
+
+    QScxmlEvent m_event;
+    bool m_parseJson;
+    QJSValue m_jsValue;
+    QJSValue m_defineData;
+    mutable QJSValue m_current;
+};
+
+static QJSValue stringOrUndefined(const QString &str)
+{
+    return str.isEmpty() ? QJSValue(QJSValue::UndefinedValue) : QJSValue(str);
+}
+
+// A JSON document is an object or an array. Anything else is not worth converting and parsing.
+static bool mayBeJsonDocument(const QString &str)
+{
+    foreach (QChar c, str) {
+        if (c.isSpace())
+            continue;
+        return c == QLatin1Char('{') || c == QLatin1Char('[');
+    }
+    return false;
+}
+
+QScxmlEventProperties::QScxmlEventProperties(QObject *parent)
+    : QObject(parent)
+    , d(new Data)
+{}
+
+QScxmlEventProperties *QScxmlEventProperties::create(QJSEngine *engine)
+{
+    QScxmlEventProperties *ep = new QScxmlEventProperties(engine);
+    ep->d->m_jsValue = engine->newQObject(ep);
+    // The getter replaces itself with a plain property holding the converted data, so that the
+    // conversion happens at most once, and so that scripts can still change or assign the data.
+    ep->d->m_defineData = engine->evaluate(QStringLiteral(
+            "(function(current, holder) {"
+            "    function settle(value) {"
+            "        Object.defineProperty(current, 'data', {"
+            "            value: value, writable: true, enumerable: true, configurable: true"
+            "        });"
+            "        return value;"
+            "    }"
+            "    Object.defineProperty(current, 'data', {"
+            "        get: function() { return settle(holder.value()); },"
+            "        set: settle, enumerable: true, configurable: true"
+            "    });"
+            "})"));
+    return ep;
+}
+
+QScxmlEventProperties::~QScxmlEventProperties()
+{
+    delete d;
+}
+
+QJSEngine *QScxmlEventProperties::engine() const
+{
+    return qobject_cast<QJSEngine *>(parent());
+}
+
+QJSValue QScxmlEventProperties::jsValue() const
+{
+    return d->m_jsValue;
+}
+
+void QScxmlEventProperties::setEvent(const QScxmlEvent &event, bool parseJson)
+{
+    d->m_event = event;
+    d->m_parseJson = parseJson;
+    d->m_current = QJSValue();
+}
+
+// Returns the object describing the current event. It is built at the first call after setEvent(),
+// and returned again for the rest of the event, so that changes a script makes to it stay visible
+// until the next event. The event data is left to the getter installed by m_defineData.
+QJSValue QScxmlEventProperties::current() const
+{
+    if (!d->m_current.isUndefined())
+        return d->m_current;
+
+    const QScxmlEvent &event = d->m_event;
+    QJSEngine *engine = this->engine();
+    QJSValue current = engine->newObject();
+    current.setProperty(QStringLiteral("invokeid"), stringOrUndefined(event.invokeId()));
+    if (!event.originType().isEmpty())
+        current.setProperty(QStringLiteral("origintype"), event.originType());
+    current.setProperty(QStringLiteral("origin"), stringOrUndefined(event.origin()));
+    current.setProperty(QStringLiteral("sendid"), stringOrUndefined(event.sendId()));
+    current.setProperty(QStringLiteral("type"), event.scxmlType());
+    current.setProperty(QStringLiteral("name"), event.name());
+    current.setProperty(QStringLiteral("raw"), QStringLiteral("unsupported")); // See test178
+    if (event.isErrorEvent())
+        current.setProperty(QStringLiteral("errorMessage"), event.errorMessage());
+
+    if (event.data().isValid()) {
+        QJSValue holder = engine->newQObject(new QScxmlEventData(event.data(), d->m_parseJson));
+        d->m_defineData.call(QJSValueList() << current << holder);
+    } else {
+        current.setProperty(QStringLiteral("data"), QJSValue(QJSValue::UndefinedValue));
+    }
+
+    d->m_current = current;
+    return current;
+}
+
+QScxmlEventData::QScxmlEventData(const QVariant &data, bool parseJson)
+    : m_data(data)
+    , m_parseJson(parseJson)
+{}
+
+// Converts the event data. The getter calling this keeps the result, so this runs only once.
+QJSValue QScxmlEventData::value() const
+{
+    QJSEngine *engine = qjsEngine(this);
+    if (!engine)
+        return QJSValue(QJSValue::UndefinedValue);
+
+    const QVariant &eventData = m_data;
+    const int type = eventData.userType();
+    if (!eventData.isValid()) {
+        return QJSValue(QJSValue::UndefinedValue);
+    } else if (type == QMetaType::QVariantMap || type == QMetaType::QJsonObject
+               || type == QMetaType::QJsonArray) {
+        // The engine converts these in one go, without going through the properties one by one.
+        return engine->toScriptValue(eventData);
+    } else if (eventData.canConvert<QVariantMap>()) {
+        const QVariantMap keyValues = eventData.value<QVariantMap>();
+        QJSValue data = engine->newObject();
+        for (QVariantMap::const_iterator it = keyValues.begin(), eit = keyValues.end(); it != eit; ++it)
+            data.setProperty(it.key(), engine->toScriptValue(it.value()));
+        return data;
+    } else if (eventData == QVariant(QMetaType::VoidStar, 0)) {
+        return QJSValue(QJSValue::NullValue);
+    } else {
+        const QString str = eventData.toString();
+        QJsonDocument doc;
+        if (m_parseJson && mayBeJsonDocument(str))
+            doc = QJsonDocument::fromJson(str.toUtf8());
+        if (!doc.isNull())
+            return engine->toScriptValue(doc.toVariant());
+        else
+            return engine->toScriptValue(str);
+    }
+}
+
 QT_END_NAMESPACE
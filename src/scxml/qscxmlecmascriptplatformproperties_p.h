@@ -52,6 +52,7 @@
 //
 
 #include "qscxmlglobals.h"
+#include "qscxmlevent.h"
 
 #include <QJSValue>
 #include <QObject>
@@ -84,6 +85,47 @@ private:
     Data *data;
 };
 
+// Backs the _event system variable. One instance is reused for all events. Scripts never see it
+// directly: _event is a getter that asks current() for a plain object describing the current event,
+// which is only built if a script reads _event at all. Its data property is a getter as well, and
+// the event data is only converted if a script reads it. A script that keeps that object keeps the
+// event it was built for.
+class QScxmlEventProperties: public QObject
+{
+    Q_OBJECT
+
+    QScxmlEventProperties(QObject *parent);
+
+public:
+    static QScxmlEventProperties *create(QJSEngine *engine);
+    ~QScxmlEventProperties();
+
+    QJSEngine *engine() const;
+    QJSValue jsValue() const;
+    void setEvent(const QScxmlEvent &event, bool parseJson);
+
+    Q_INVOKABLE QJSValue current() const;
+
+private:
+    class Data;
+    Data *d;
+};
+
+// Holds the data of one event until a script reads _event.data. Owned by the JavaScript engine.
+class QScxmlEventData: public QObject
+{
+    Q_OBJECT
+
+public:
+    QScxmlEventData(const QVariant &data, bool parseJson);
+
+    Q_INVOKABLE QJSValue value() const;
+
+private:
+    QVariant m_data;
+    bool m_parseJson;
+};
+
 QT_END_NAMESPACE
 
 #endif // ECMASCRIPTPLATFORMPROPERTIES_P_H
@@ -37,12 +37,15 @@
 **
 ****************************************************************************/
 
+#include "qscxmldatamodel_p.h"
 #include "qscxmlexecutablecontent_p.h"
 #include "qscxmlevent_p.h"
 #include "qscxmlstatemachine_p.h"
 
+#include <QAtomicPointer>
 #include <QJsonDocument>
 #include <QJsonObject>
+#include <QThreadStorage>
 
 QT_BEGIN_NAMESPACE
 
@@ -53,6 +56,234 @@ QEvent::Type QScxmlEvent::ignoreEventType = (QEvent::Type) QEvent::registerEvent
 
 QAtomicInt QScxmlEventBuilder::idCounter = QAtomicInt(0);
 
+// Cleared events all share the same empty payload, so clearing the current event of a state
+// machine for every processed event does not allocate.
+Q_GLOBAL_STATIC_WITH_ARGS(QSharedDataPointer<QScxmlEventPrivate>, emptyEventPrivate,
+                          (new QScxmlEventPrivate))
+
+namespace {
+// Freed payload memory of one thread, ready for reuse. Events are handed between threads, so a
+// payload is often freed by another thread than the one that allocated it, typically when a
+// thread only posts events and another one only processes them. Each block therefore remembers
+// the pool it came from, and a foreign thread hands it back through a lock-free stack that the
+// owning thread drains when it runs out of local blocks.
+class EventPrivatePool
+{
+    struct Block
+    {
+        EventPrivatePool *pool; // Q_NULLPTR if allocated without a pool
+        Block *next; // in the stack of blocks freed by other threads
+    };
+
+    // The payload follows the header, suitably aligned.
+    enum { HeaderSize = (sizeof(Block) + Q_ALIGNOF(QScxmlEventPrivate) - 1)
+                        / Q_ALIGNOF(QScxmlEventPrivate) * Q_ALIGNOF(QScxmlEventPrivate) };
+
+public:
+    // Each block allocated by the pool holds a reference to it, and so does the owning thread
+    // while it runs.
+    EventPrivatePool()
+        : m_ref(1)
+        , m_ownerAlive(1)
+        , m_remoteFree(Q_NULLPTR)
+    {}
+
+    // Called when the owning thread goes away. Blocks still in use are freed by the threads that
+    // release them, and the last one deletes the pool.
+    void retire()
+    {
+        m_ownerAlive.storeRelease(0);
+        foreach (Block *block, m_localFree)
+            release(block);
+        m_localFree.clear();
+        releaseRemoteFree();
+        deref();
+    }
+
+    static void *allocate(EventPrivatePool *pool, size_t size)
+    {
+        if (pool) {
+            if (Block *block = pool->take())
+                return payload(block);
+            pool->m_ref.ref();
+        }
+        Block *block = static_cast<Block *>(::operator new(HeaderSize + size));
+        block->pool = pool;
+        return payload(block);
+    }
+
+    static void deallocate(EventPrivatePool *currentPool, void *ptr)
+    {
+        Block *block = reinterpret_cast<Block *>(static_cast<char *>(ptr) - HeaderSize);
+        EventPrivatePool *pool = block->pool;
+        if (!pool) {
+            ::operator delete(block);
+        } else if (pool == currentPool) {
+            if (pool->m_localFree.size() < MaxFreeCount)
+                pool->m_localFree.append(block);
+            else
+                pool->release(block);
+        } else {
+            pool->giveBack(block);
+        }
+    }
+
+private:
+    enum { MaxFreeCount = 256 };
+
+    static void *payload(Block *block)
+    { return reinterpret_cast<char *>(block) + HeaderSize; }
+
+    Block *take()
+    {
+        if (m_localFree.isEmpty()) {
+            // Only this thread takes blocks off the stack, and it takes all of them at once, so
+            // there is no ABA problem with the threads pushing onto it.
+            Block *block = m_remoteFree.fetchAndStoreAcquire(Q_NULLPTR);
+            for (; block; block = block->next) {
+                if (m_localFree.size() < MaxFreeCount)
+                    m_localFree.append(block);
+                else
+                    release(block);
+            }
+        }
+        return m_localFree.isEmpty() ? Q_NULLPTR : m_localFree.takeLast();
+    }
+
+    void giveBack(Block *block)
+    {
+        // Keep the pool alive until the block is either on the stack or freed.
+        m_ref.ref();
+        if (m_ownerAlive.loadAcquire()) {
+            Block *head = m_remoteFree.loadAcquire();
+            do {
+                block->next = head;
+            } while (!m_remoteFree.testAndSetOrdered(head, block, head));
+        } else {
+            release(block);
+        }
+        // The owning thread may have retired in the meantime, without seeing the block.
+        if (!m_ownerAlive.loadAcquire())
+            releaseRemoteFree();
+        deref();
+    }
+
+    void releaseRemoteFree()
+    {
+        Block *block = m_remoteFree.fetchAndStoreAcquire(Q_NULLPTR);
+        while (block) {
+            Block *next = block->next;
+            release(block);
+            block = next;
+        }
+    }
+
+    void release(Block *block)
+    {
+        ::operator delete(block);
+        deref();
+    }
+
+    void deref()
+    {
+        if (!m_ref.deref())
+            delete this;
+    }
+
+    QAtomicInt m_ref;
+    QAtomicInt m_ownerAlive;
+    QAtomicPointer<Block> m_remoteFree;
+    QVector<Block *> m_localFree; // only touched by the owning thread
+};
+
+// QThreadStorage deletes this when the thread finishes.
+class EventPrivatePoolOwner
+{
+public:
+    EventPrivatePoolOwner() : pool(new EventPrivatePool) {}
+    ~EventPrivatePoolOwner() { pool->retire(); }
+
+    EventPrivatePool *pool;
+};
+} // anonymous namespace
+
+Q_GLOBAL_STATIC(QThreadStorage<EventPrivatePoolOwner *>, eventPrivatePools)
+
+static EventPrivatePool *currentEventPrivatePool(bool create)
+{
+    if (eventPrivatePools.isDestroyed())
+        return Q_NULLPTR;
+    QThreadStorage<EventPrivatePoolOwner *> *pools = eventPrivatePools();
+    if (!pools->hasLocalData()) {
+        if (!create)
+            return Q_NULLPTR;
+        pools->setLocalData(new EventPrivatePoolOwner);
+    }
+    return pools->localData()->pool;
+}
+
+void *QScxmlEventPrivate::operator new(size_t size)
+{
+    Q_ASSERT(size == sizeof(QScxmlEventPrivate));
+    return EventPrivatePool::allocate(currentEventPrivatePool(true), size);
+}
+
+void QScxmlEventPrivate::operator delete(void *ptr)
+{
+    if (ptr)
+        EventPrivatePool::deallocate(currentEventPrivatePool(false), ptr);
+}
+
+// This runs for every setOrigin() and setOriginType(), so most strings are turned away by their
+// length and first character, without comparing them as a whole.
+QScxmlInternal::EventAtom QScxmlInternal::eventAtom(const QString &str)
+{
+    static const QLatin1String internalTarget("#_internal");
+    static const QLatin1String parentTarget("#_parent");
+    static const QLatin1String scxmlEventProcessorType("http://www.w3.org/TR/scxml/#SCXMLEventProcessor");
+    static const QLatin1String qtSignalType("qt:signal");
+
+    if (str.isEmpty())
+        return EmptyAtom;
+
+    const int size = str.size();
+    switch (str.at(0).unicode()) {
+    case '#':
+        if (size == internalTarget.size() && str == internalTarget)
+            return InternalTargetAtom;
+        if (size == parentTarget.size() && str == parentTarget)
+            return ParentTargetAtom;
+        break;
+    case 'h':
+        if (size == scxmlEventProcessorType.size() && str == scxmlEventProcessorType)
+            return ScxmlEventProcessorTypeAtom;
+        break;
+    case 'q':
+        if (size == qtSignalType.size() && str == qtSignalType)
+            return QtSignalTypeAtom;
+        break;
+    default:
+        break;
+    }
+    return OtherAtom;
+}
+
+QString QScxmlInternal::eventAtomString(EventAtom atom)
+{
+    switch (atom) {
+    case InternalTargetAtom:
+        return QStringLiteral("#_internal");
+    case ParentTargetAtom:
+        return QStringLiteral("#_parent");
+    case ScxmlEventProcessorTypeAtom:
+        return QStringLiteral("http://www.w3.org/TR/scxml/#SCXMLEventProcessor");
+    case QtSignalTypeAtom:
+        return QStringLiteral("qt:signal");
+    default:
+        return QString();
+    }
+}
+
 QScxmlEvent *QScxmlEventBuilder::buildEvent()
 {
     auto dataModel = stateMachine ? stateMachine->dataModel() : Q_NULLPTR;
@@ -61,7 +292,7 @@ QScxmlEvent *QScxmlEventBuilder::buildEvent()
     QString eventName = event;
     bool ok = true;
     if (eventexpr != NoEvaluator) {
-        eventName = dataModel->evaluateToString(eventexpr, &ok);
+        eventName = QScxmlDataModelPrivate::get(dataModel)->evaluateToString(eventexpr, &ok);
         ok = true; // ignore failure.
     }
 
@@ -70,7 +301,7 @@ QScxmlEvent *QScxmlEventBuilder::buildEvent()
         if (contentExpr == NoEvaluator) {
             data = contents;
         } else {
-            data = dataModel->evaluateToString(contentExpr, &ok);
+            data = QScxmlDataModelPrivate::get(dataModel)->evaluateToString(contentExpr, &ok);
         }
         if (!ok) {
             // expr evaluation failure results in the data property of the event being set to null. See e.g. test528.
@@ -103,15 +334,17 @@ QScxmlEvent *QScxmlEventBuilder::buildEvent()
 
     QString origin = target;
     if (targetexpr != NoEvaluator) {
-        origin = dataModel->evaluateToString(targetexpr, &ok);
+        origin = QScxmlDataModelPrivate::get(dataModel)->evaluateToString(targetexpr, &ok);
         if (!ok)
             return Q_NULLPTR;
     }
-    if (origin.isEmpty()) {
+    QScxmlInternal::EventAtom originAtom = QScxmlInternal::eventAtom(origin);
+    if (originAtom == QScxmlInternal::EmptyAtom) {
         if (eventType == QScxmlEvent::ExternalEvent) {
-            origin = QStringLiteral("#_internal");
+            originAtom = QScxmlInternal::InternalTargetAtom;
+            origin = QScxmlInternal::eventAtomString(originAtom);
         }
-    } else if (origin == QStringLiteral("#_parent")) {
+    } else if (originAtom == QScxmlInternal::ParentTargetAtom) {
         // allow sending messages to the parent, independently of whether we're invoked or not.
     } else if (!origin.startsWith(QLatin1Char('#'))) {
         // [6.2.4] and test194.
@@ -132,16 +365,17 @@ QScxmlEvent *QScxmlEventBuilder::buildEvent()
     QString origintype = type;
     if (origintype.isEmpty()) {
         // [6.2.5] and test198
-        origintype = QStringLiteral("http://www.w3.org/TR/scxml/#SCXMLEventProcessor");
+        origintype = QScxmlInternal::eventAtomString(QScxmlInternal::ScxmlEventProcessorTypeAtom);
     }
     if (typeexpr != NoEvaluator) {
-        origintype = dataModel->evaluateToString(typeexpr, &ok);
+        origintype = QScxmlDataModelPrivate::get(dataModel)->evaluateToString(typeexpr, &ok);
         if (!ok)
             return Q_NULLPTR;
     }
-    if (!origintype.isEmpty()
-            && origintype != QStringLiteral("qt:signal")
-            && origintype != QStringLiteral("http://www.w3.org/TR/scxml/#SCXMLEventProcessor")) {
+    const QScxmlInternal::EventAtom origintypeAtom = QScxmlInternal::eventAtom(origintype);
+    if (origintypeAtom != QScxmlInternal::EmptyAtom
+            && origintypeAtom != QScxmlInternal::QtSignalTypeAtom
+            && origintypeAtom != QScxmlInternal::ScxmlEventProcessorTypeAtom) {
         // [6.2.5] and test199
         submitError(QStringLiteral("error.execution"),
                     QStringLiteral("Error in %1: %2 is not a valid type")
@@ -160,9 +394,12 @@ QScxmlEvent *QScxmlEventBuilder::buildEvent()
     event->setEventType(eventType);
     event->setData(data);
     event->setSendId(sendid);
-    event->setOrigin(origin);
-    event->setOriginType(origintype);
     event->setInvokeId(invokeid);
+    QScxmlEventPrivate *ed = QScxmlEventPrivate::getWritable(event);
+    ed->origin = origin;
+    ed->originAtom = originAtom;
+    ed->originType = origintype;
+    ed->originTypeAtom = origintypeAtom;
     return event;
 }
 
@@ -187,7 +424,7 @@ bool QScxmlEventBuilder::evaluate(const Param &param, QScxmlStateMachine *stateM
     auto tableData = stateMachine->tableData();
     if (param.expr != NoEvaluator) {
         bool success = false;
-        auto v = dataModel->evaluateToVariant(param.expr, &success);
+        auto v = QScxmlDataModelPrivate::get(dataModel)->evaluateToVariant(param.expr, &success);
         keyValues.insert(tableData->string(param.name), v);
         return success;
     }
@@ -275,7 +512,6 @@ QScxmlEvent::QScxmlEvent()
  */
 QScxmlEvent::~QScxmlEvent()
 {
-    delete d;
 }
 
 /*!
@@ -299,7 +535,10 @@ QString QScxmlEvent::scxmlType() const
  */
 void QScxmlEvent::clear()
 {
-    *d = QScxmlEventPrivate();
+    if (!emptyEventPrivate.isDestroyed())
+        d = *emptyEventPrivate;
+    else
+        d = new QScxmlEventPrivate;
 }
 
 /*!
@@ -309,7 +548,7 @@ void QScxmlEvent::clear()
 QScxmlEvent &QScxmlEvent::operator=(const QScxmlEvent &other)
 {
     QEvent::operator=(other);
-    *d = *other.d;
+    d = other.d;
     return *this;
 }
 
@@ -317,7 +556,7 @@ QScxmlEvent &QScxmlEvent::operator=(const QScxmlEvent &other)
  * Constructs a copy of \a other.
  */
 QScxmlEvent::QScxmlEvent(const QScxmlEvent &other)
-    : QEvent(other), d(new QScxmlEventPrivate(*other.d))
+    : QEvent(other), d(other.d)
 {
 }
 
@@ -406,6 +645,7 @@ QString QScxmlEvent::origin() const
 void QScxmlEvent::setOrigin(const QString &origin)
 {
     d->origin = origin;
+    d->originAtom = QScxmlInternal::eventAtom(origin);
 }
 
 /*!
@@ -433,6 +673,7 @@ QString QScxmlEvent::originType() const
 void QScxmlEvent::setOriginType(const QString &origintype)
 {
     d->originType = origintype;
+    d->originTypeAtom = QScxmlInternal::eventAtom(origintype);
 }
 
 /*!
@@ -534,6 +775,28 @@ void QScxmlEvent::setData(const QVariant &data)
         d->data = data;
 }
 
+/*!
+ * Returns \c true if the payload of this event is marked as JSON text.
+ *
+ * \sa setJsonData(), QScxmlStateMachine::JsonDataParsing
+ */
+bool QScxmlEvent::isJsonData() const
+{
+    return d->jsonData;
+}
+
+/*!
+ * Marks the payload of this event as JSON text if \a json is \c true. A state machine
+ * using QScxmlStateMachine::ParseMarkedJsonData only parses the string payloads of marked
+ * events.
+ *
+ * \sa isJsonData()
+ */
+void QScxmlEvent::setJsonData(bool json)
+{
+    d->jsonData = json;
+}
+
 /*!
  * Returns \c true when this is an error event, \c false otherwise.
  */
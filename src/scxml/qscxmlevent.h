@@ -43,6 +43,7 @@
 #include <QtScxml/qscxmlglobals.h>
 
 #include <QEvent>
+#include <QSharedDataPointer>
 #include <QStringList>
 #include <QVariantList>
 
@@ -106,6 +107,9 @@ public:
     QVariant data() const;
     void setData(const QVariant &data);
 
+    bool isJsonData() const;
+    void setJsonData(bool json);
+
     bool isErrorEvent() const;
     QString errorMessage() const;
     void setErrorMessage(const QString &message);
@@ -119,7 +123,8 @@ protected:
 #endif // Q_QDOC
 
 private:
-    QScxmlEventPrivate *d;
+    friend class QScxmlEventPrivate;
+    QSharedDataPointer<QScxmlEventPrivate> d;
 
 };
 
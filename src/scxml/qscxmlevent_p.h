@@ -59,6 +59,7 @@
 #endif
 
 #include <QAtomicInt>
+#include <QSharedData>
 
 QT_BEGIN_NAMESPACE
 
@@ -153,14 +154,48 @@ public:
 };
 #endif // BUILD_QSCXMLC
 
-class QScxmlEventPrivate
+namespace QScxmlInternal {
+// The well-known values of the origin and origin type of an event. Events keep the atom next to
+// the string, so that routing and event filters can compare integers instead of strings.
+enum EventAtom {
+    EmptyAtom,
+    OtherAtom, // any string that is not one of the ones below
+    ParentTargetAtom, // #_parent
+    InternalTargetAtom, // #_internal
+    QtSignalTypeAtom, // qt:signal
+    ScxmlEventProcessorTypeAtom // http://www.w3.org/TR/scxml/#SCXMLEventProcessor
+};
+
+EventAtom eventAtom(const QString &str);
+QString eventAtomString(EventAtom atom);
+} // QScxmlInternal namespace
+
+// The payload of an event is implicitly shared, so that copies made when routing an event to
+// invoked services, auto-forwarding it, or keeping it as the current event of a state machine do
+// not allocate or copy the strings and data.
+class QScxmlEventPrivate : public QSharedData
 {
 public:
     QScxmlEventPrivate()
         : eventType(QScxmlEvent::ExternalEvent)
         , delayInMiliSecs(0)
+        , jsonData(false)
+        , originAtom(QScxmlInternal::EmptyAtom)
+        , originTypeAtom(QScxmlInternal::EmptyAtom)
     {}
 
+    // Detaches the event from any copies sharing its payload. Use get() for read-only access.
+    static QScxmlEventPrivate *getWritable(QScxmlEvent *event)
+    { return event->d.data(); }
+    static const QScxmlEventPrivate *get(const QScxmlEvent *event)
+    { return event->d.constData(); }
+
+    // Payloads are created and destroyed for nearly every event, so their memory is recycled
+    // through a small per-thread pool. A payload freed by another thread goes back to the pool of
+    // the thread that allocated it.
+    static void *operator new(size_t size);
+    static void operator delete(void *ptr);
+
     QString name;
     QScxmlEvent::EventType eventType;
     QVariant data; // extra data
@@ -169,6 +204,9 @@ public:
     QString originType; // type to answer by setting the type of send, empty for internal and platform events
     QString invokeId; // id of the invocation that triggered the child process if this was invoked
     int delayInMiliSecs;
+    bool jsonData; // the data is a string to be parsed as JSON
+    QScxmlInternal::EventAtom originAtom;
+    QScxmlInternal::EventAtom originTypeAtom;
 
     static QByteArray debugString(QScxmlEvent *event);
 };
@@ -41,6 +41,13 @@
 #include "qscxmlexecutablecontent_p.h"
 #include "qscxmlparser_p.h"
 #include "qscxmlevent_p.h"
+#include "qscxmltracer.h"
+
+#ifndef BUILD_QSCXMLC
+#include "qscxmldatamodel_p.h"
+#endif
+
+#include <QVarLengthArray>
 
 QT_BEGIN_NAMESPACE
 
@@ -85,6 +92,9 @@ static int parseTime(const QString &t, bool *ok = 0)
 
 QScxmlExecutionEngine::QScxmlExecutionEngine(QScxmlStateMachine *stateMachine)
     : stateMachine(stateMachine)
+    , dataModel(Q_NULLPTR)
+    , tableData(Q_NULLPTR)
+    , tracer(Q_NULLPTR)
 {
     Q_ASSERT(stateMachine);
 }
@@ -96,215 +106,305 @@ bool QScxmlExecutionEngine::execute(ContainerId id, const QVariant &extraData)
     if (id == NoInstruction)
         return true;
 
-    qint32 *ip = stateMachine->tableData()->instructions() + id;
+    // Executable content can run other executable content, for example when a <send> is processed
+    // right away. Restore the outer context when done.
+    QScxmlDataModelPrivate *outerDataModel = dataModel;
+    QScxmlTableData *outerTableData = tableData;
+    QScxmlTracer *outerTracer = tracer;
+    QVariant outerExtraData = this->extraData;
+
+    // None of these can change while executable content runs.
+    dataModel = QScxmlDataModelPrivate::get(stateMachine->dataModel());
+    tableData = stateMachine->tableData();
+    tracer = stateMachine->tracer();
     this->extraData = extraData;
-    bool result = step(ip);
-    this->extraData = QVariant();
+
+    Instructions ip = tableData->instructions() + id;
+    bool result = run(ip, ip + 1);
+
+    dataModel = outerDataModel;
+    tableData = outerTableData;
+    tracer = outerTracer;
+    this->extraData = outerExtraData;
     return result;
 }
 
-bool QScxmlExecutionEngine::step(Instructions &ip)
+/*!
+ * \internal
+ * Records the instruction at \a ip, together with the evaluator it runs, in the tracer.
+ */
+void QScxmlExecutionEngine::traceInstruction(Instructions ip)
 {
-    auto dataModel = stateMachine->dataModel();
-    auto tableData = stateMachine->tableData();
-
-    auto instr = reinterpret_cast<Instruction *>(ip);
+    EvaluatorId evaluator = NoEvaluator;
+    Instruction *instr = reinterpret_cast<Instruction *>(ip);
     switch (instr->instructionType) {
-    case Instruction::Sequence: {
-        qCDebug(qscxmlLog) << stateMachine << "Executing sequence step";
-        InstructionSequence *sequence = reinterpret_cast<InstructionSequence *>(instr);
-        ip = sequence->instructions();
-        Instructions end = ip + sequence->entryCount;
-        while (ip < end) {
-            if (!step(ip)) {
-                ip = end;
-                qCDebug(qscxmlLog) << stateMachine << "Finished sequence step UNsuccessfully";
-                return false;
-            }
-        }
-        qCDebug(qscxmlLog) << stateMachine << "Finished sequence step successfully";
-        return true;
+    case Instruction::JavaScript:
+        evaluator = reinterpret_cast<JavaScript *>(instr)->go;
+        break;
+    case Instruction::Assign:
+        evaluator = reinterpret_cast<Assign *>(instr)->expression;
+        break;
+    case Instruction::Initialize:
+        evaluator = reinterpret_cast<Initialize *>(instr)->expression;
+        break;
+    case Instruction::Log:
+        evaluator = reinterpret_cast<Log *>(instr)->expr;
+        break;
+    case Instruction::Foreach:
+        evaluator = reinterpret_cast<Foreach *>(instr)->doIt;
+        break;
+    case Instruction::Send:
+        evaluator = reinterpret_cast<Send *>(instr)->delayexpr;
+        break;
+    case Instruction::Cancel:
+        evaluator = reinterpret_cast<Cancel *>(instr)->sendidexpr;
+        break;
+    default:
+        break;
     }
 
-    case Instruction::Sequences: {
-        qCDebug(qscxmlLog) << stateMachine << "Executing sequences step";
-        InstructionSequences *sequences = reinterpret_cast<InstructionSequences *>(instr);
-        ip += sequences->size();
-        for (int i = 0; i != sequences->sequenceCount; ++i) {
-            Instructions sequence = sequences->at(i);
-            step(sequence);
+    const QScxmlTracer::Record record = {
+        tracer->elapsed(), QScxmlTracer::InstructionExecuted,
+        qint32(ip - tableData->instructions()), evaluator
+    };
+    tracer->record(record);
+}
+
+/*!
+ * \internal
+ * Executes the instructions from \a ip up to \a end, including the blocks that are entered on the
+ * way. Returns \c false as soon as an instruction fails.
+ *
+ * Entering a block does not recurse: the position to continue at after the block is pushed on a
+ * local stack instead. Only <foreach> recurses, as the data model drives the loop.
+ */
+bool QScxmlExecutionEngine::run(Instructions ip, Instructions end)
+{
+    struct Frame
+    {
+        Instructions resume;
+        Instructions end;
+    };
+    QVarLengthArray<Frame, 8> frames;
+
+    forever {
+        if (ip >= end) {
+            if (frames.isEmpty())
+                return true;
+            ip = frames.last().resume;
+            end = frames.last().end;
+            frames.removeLast();
+            continue;
         }
-        qCDebug(qscxmlLog) << stateMachine << "Finished sequences step";
-        return true;
-    }
 
-    case Instruction::Send: {
-        qCDebug(qscxmlLog) << stateMachine << "Executing send step";
-        Send *send = reinterpret_cast<Send *>(instr);
-        ip += send->size();
-
-        QString delay = tableData->string(send->delay);
-        if (send->delayexpr != NoEvaluator) {
-            bool ok = false;
-            delay = stateMachine->dataModel()->evaluateToString(send->delayexpr, &ok);
-            if (!ok)
-                return false;
+        Instruction *instr = reinterpret_cast<Instruction *>(ip);
+        bool ok = true;
+        if (tracer)
+            traceInstruction(ip);
+
+        // The instruction types are dense, so this is a single indirect jump.
+        switch (instr->instructionType) {
+        case Instruction::Sequence: {
+            qscxmlTrace() << stateMachine << "Executing sequence step";
+            InstructionSequence *sequence = reinterpret_cast<InstructionSequence *>(instr);
+            const Frame frame = { ip + sequence->size(), end };
+            frames.append(frame);
+            ip = sequence->instructions();
+            end = ip + sequence->entryCount;
+            continue;
         }
 
-        QScxmlEvent *event = QScxmlEventBuilder(stateMachine, *send).buildEvent();
-        if (!event)
-            return false;
+        case Instruction::Sequences: {
+            qscxmlTrace() << stateMachine << "Executing sequences step";
+            InstructionSequences *sequences = reinterpret_cast<InstructionSequences *>(instr);
+            ip += sequences->size();
 
-        if (!delay.isEmpty()) {
-            int msecs = parseTime(delay);
-            if (msecs >= 0) {
-                event->setDelay(msecs);
-            } else {
-                qCDebug(qscxmlLog) << stateMachine << "failed to parse delay time" << delay;
-                return false;
+            // The sequences are independent: one failing doesn't stop the others.
+            Instructions sequence = reinterpret_cast<Instructions>(sequences->sequences());
+            for (qint32 i = 0; i != sequences->sequenceCount; ++i) {
+                run(sequence, sequence + 1);
+                sequence += reinterpret_cast<InstructionSequence *>(sequence)->size();
             }
+            qscxmlTrace() << stateMachine << "Finished sequences step";
+            break;
         }
 
-        stateMachine->submitEvent(event);
-        return true;
-    }
+        case Instruction::Send: {
+            qscxmlTrace() << stateMachine << "Executing send step";
+            Send *send = reinterpret_cast<Send *>(instr);
+            ip += send->size();
 
-    case Instruction::JavaScript: {
-        qCDebug(qscxmlLog) << stateMachine << "Executing script step";
-        JavaScript *javascript = reinterpret_cast<JavaScript *>(instr);
-        ip += javascript->size();
-        bool ok = true;
-        dataModel->evaluateToVoid(javascript->go, &ok);
-        return ok;
-    }
+            QString delay = tableData->string(send->delay);
+            if (send->delayexpr != NoEvaluator) {
+                delay = dataModel->evaluateToString(send->delayexpr, &ok);
+                if (!ok)
+                    break;
+            }
 
-    case Instruction::If: {
-        qCDebug(qscxmlLog) << stateMachine << "Executing if step";
-        If *_if = reinterpret_cast<If *>(instr);
-        ip += _if->size();
-        auto blocks = _if->blocks();
-        for (qint32 i = 0; i < _if->conditions.count; ++i) {
-            bool ok = true;
-            if (dataModel->evaluateToBool(_if->conditions.at(i), &ok) && ok) {
-                Instructions block = blocks->at(i);
-                bool res = step(block);
-                qCDebug(qscxmlLog) << stateMachine << "Finished if step";
-                return res;
+            QScxmlEvent *event = QScxmlEventBuilder(stateMachine, *send).buildEvent();
+            if (!event) {
+                ok = false;
+                break;
             }
-        }
 
-        if (_if->conditions.count < blocks->sequenceCount) {
-            Instructions block = blocks->at(_if->conditions.count);
-            return step(block);
+            if (!delay.isEmpty()) {
+                int msecs = parseTime(delay);
+                if (msecs >= 0) {
+                    event->setDelay(msecs);
+                } else {
+                    qscxmlTrace() << stateMachine << "failed to parse delay time" << delay;
+                    ok = false;
+                    break;
+                }
+            }
+
+            stateMachine->submitEvent(event);
+            break;
         }
 
-        return true;
-    }
+        case Instruction::JavaScript: {
+            qscxmlTrace() << stateMachine << "Executing script step";
+            JavaScript *javascript = reinterpret_cast<JavaScript *>(instr);
+            ip += javascript->size();
+            dataModel->evaluateToVoid(javascript->go, &ok);
+            break;
+        }
 
-    case Instruction::Foreach: {
-        class LoopBody: public QScxmlDataModel::ForeachLoopBody // If only we could put std::function in public API, we could use a lambda here. Alas....
-        {
-            QScxmlExecutionEngine *engine;
-            const Instructions loopStart;
+        case Instruction::If: {
+            qscxmlTrace() << stateMachine << "Executing if step";
+            If *_if = reinterpret_cast<If *>(instr);
+            ip += _if->size();
+            InstructionSequences *blocks = _if->blocks();
+
+            // Walk the blocks along with the conditions, instead of searching each one from the
+            // start.
+            Instructions block = reinterpret_cast<Instructions>(blocks->sequences());
+            qint32 i = 0;
+            for (; i < _if->conditions.count; ++i) {
+                bool conditionOk = true;
+                if (dataModel->evaluateToBool(_if->conditions.at(i), &conditionOk) && conditionOk)
+                    break;
+                block += reinterpret_cast<InstructionSequence *>(block)->size();
+            }
 
-        public:
-            LoopBody(QScxmlExecutionEngine *engine, const Instructions loopStart)
-                : engine(engine)
-                , loopStart(loopStart)
-            {}
+            // Either a condition matched, or there is an <else> block after the conditional ones.
+            if (i < blocks->sequenceCount) {
+                InstructionSequence *sequence = reinterpret_cast<InstructionSequence *>(block);
+                const Frame frame = { ip, end };
+                frames.append(frame);
+                ip = sequence->instructions();
+                end = ip + sequence->entryCount;
+            }
+            continue;
+        }
 
-            bool run() Q_DECL_OVERRIDE
+        case Instruction::Foreach: {
+            class LoopBody: public QScxmlDataModel::ForeachLoopBody // If only we could put std::function in public API, we could use a lambda here. Alas....
             {
-                Instructions ip = loopStart;
-                return engine->step(ip);
-            }
-        };
+                QScxmlExecutionEngine *engine;
+                const Instructions loopStart;
+
+            public:
+                LoopBody(QScxmlExecutionEngine *engine, const Instructions loopStart)
+                    : engine(engine)
+                    , loopStart(loopStart)
+                {}
+
+                bool run() Q_DECL_OVERRIDE
+                {
+                    return engine->run(loopStart, loopStart + 1);
+                }
+            };
+
+            qscxmlTrace() << stateMachine << "Executing foreach step";
+            Foreach *foreach = reinterpret_cast<Foreach *>(instr);
+            Instructions loopStart = foreach->blockstart();
+            ip += foreach->size();
+            LoopBody body(this, loopStart);
+            bool evenMoreOk = dataModel->evaluateForeach(foreach->doIt, &ok, &body);
+            ok = ok && evenMoreOk;
+            break;
+        }
 
-        qCDebug(qscxmlLog) << stateMachine << "Executing foreach step";
-        Foreach *foreach = reinterpret_cast<Foreach *>(instr);
-        Instructions loopStart = foreach->blockstart();
-        ip += foreach->size();
-        bool ok = true;
-        LoopBody body(this, loopStart);
-        bool evenMoreOk = dataModel->evaluateForeach(foreach->doIt, &ok, &body);
-        return ok && evenMoreOk;
-    }
+        case Instruction::Raise: {
+            qscxmlTrace() << stateMachine << "Executing raise step";
+            Raise *raise = reinterpret_cast<Raise *>(instr);
+            ip += raise->size();
+            auto name = tableData->string(raise->event);
+            auto event = new QScxmlEvent;
+            event->setName(name);
+            event->setEventType(QScxmlEvent::InternalEvent);
+            stateMachine->submitEvent(event);
+            break;
+        }
 
-    case Instruction::Raise: {
-        qCDebug(qscxmlLog) << stateMachine << "Executing raise step";
-        Raise *raise = reinterpret_cast<Raise *>(instr);
-        ip += raise->size();
-        auto name = tableData->string(raise->event);
-        auto event = new QScxmlEvent;
-        event->setName(name);
-        event->setEventType(QScxmlEvent::InternalEvent);
-        stateMachine->submitEvent(event);
-        return true;
-    }
+        case Instruction::Log: {
+            qscxmlTrace() << stateMachine << "Executing log step";
+            Log *log = reinterpret_cast<Log *>(instr);
+            ip += log->size();
+            QString str = dataModel->evaluateToString(log->expr, &ok);
+            if (ok) {
+                const QString label = tableData->string(log->label);
+                qCDebug(scxmlLog) << label << ":" << str;
+                QMetaObject::invokeMethod(stateMachine,
+                                          "log",
+                                          Qt::QueuedConnection,
+                                          Q_ARG(QString, label),
+                                          Q_ARG(QString, str));
+            }
+            break;
+        }
 
-    case Instruction::Log: {
-        qCDebug(qscxmlLog) << stateMachine << "Executing log step";
-        Log *log = reinterpret_cast<Log *>(instr);
-        ip += log->size();
-        bool ok = true;
-        QString str = dataModel->evaluateToString(log->expr, &ok);
-        if (ok) {
-            const QString label = tableData->string(log->label);
-            qCDebug(scxmlLog) << label << ":" << str;
-            QMetaObject::invokeMethod(stateMachine,
-                                      "log",
-                                      Qt::QueuedConnection,
-                                      Q_ARG(QString, label),
-                                      Q_ARG(QString, str));
+        case Instruction::Cancel: {
+            qscxmlTrace() << stateMachine << "Executing cancel step";
+            Cancel *cancel = reinterpret_cast<Cancel *>(instr);
+            ip += cancel->size();
+            QString e = tableData->string(cancel->sendid);
+            if (cancel->sendidexpr != NoEvaluator)
+                e = dataModel->evaluateToString(cancel->sendidexpr, &ok);
+            if (ok && !e.isEmpty())
+                stateMachine->cancelDelayedEvent(e);
+            break;
         }
-        return ok;
-    }
 
-    case Instruction::Cancel: {
-        qCDebug(qscxmlLog) << stateMachine << "Executing cancel step";
-        Cancel *cancel = reinterpret_cast<Cancel *>(instr);
-        ip += cancel->size();
-        QString e = tableData->string(cancel->sendid);
-        bool ok = true;
-        if (cancel->sendidexpr != NoEvaluator)
-            e = dataModel->evaluateToString(cancel->sendidexpr, &ok);
-        if (ok && !e.isEmpty())
-            stateMachine->cancelDelayedEvent(e);
-        return ok;
-    }
+        case Instruction::Assign: {
+            qscxmlTrace() << stateMachine << "Executing assign step";
+            Assign *assign = reinterpret_cast<Assign *>(instr);
+            ip += assign->size();
+            dataModel->evaluateAssignment(assign->expression, &ok);
+            break;
+        }
 
-    case Instruction::Assign: {
-        qCDebug(qscxmlLog) << stateMachine << "Executing assign step";
-        Assign *assign = reinterpret_cast<Assign *>(instr);
-        ip += assign->size();
-        bool ok = true;
-        dataModel->evaluateAssignment(assign->expression, &ok);
-        return ok;
-    }
+        case Instruction::Initialize: {
+            qscxmlTrace() << stateMachine << "Executing initialize step";
+            Initialize *init = reinterpret_cast<Initialize *>(instr);
+            ip += init->size();
+            dataModel->evaluateInitialization(init->expression, &ok);
+            break;
+        }
 
-    case Instruction::Initialize: {
-        qCDebug(qscxmlLog) << stateMachine << "Executing initialize step";
-        Initialize *init = reinterpret_cast<Initialize *>(instr);
-        ip += init->size();
-        bool ok = true;
-        dataModel->evaluateInitialization(init->expression, &ok);
-        return ok;
-    }
+        case Instruction::DoneData: {
+            qscxmlTrace() << stateMachine << "Executing DoneData step";
+            DoneData *doneData = reinterpret_cast<DoneData *>(instr);
+            // A DoneData is only ever executed on its own.
+            ip = end;
 
-    case Instruction::DoneData: {
-        qCDebug(qscxmlLog) << stateMachine << "Executing DoneData step";
-        DoneData *doneData = reinterpret_cast<DoneData *>(instr);
+            QString eventName = QStringLiteral("done.state.") + extraData.toString();
+            QScxmlEventBuilder event(stateMachine, eventName, doneData);
+            qscxmlTrace() << stateMachine << "submitting event" << eventName;
+            stateMachine->submitEvent(event());
+            break;
+        }
 
-        QString eventName = QStringLiteral("done.state.") + extraData.toString();
-        QScxmlEventBuilder event(stateMachine, eventName, doneData);
-        qCDebug(qscxmlLog) << stateMachine << "submitting event" << eventName;
-        stateMachine->submitEvent(event());
-        return true;
-    }
+        default:
+            Q_UNREACHABLE();
+            return false;
+        }
 
-    default:
-        Q_UNREACHABLE();
-        return false;
+        if (!ok) {
+            qscxmlTrace() << stateMachine << "Finished sequence step UNsuccessfully";
+            return false;
+        }
     }
 }
 #endif // BUILD_QSCXMLC
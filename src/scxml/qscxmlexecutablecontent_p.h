@@ -64,6 +64,9 @@
 
 QT_BEGIN_NAMESPACE
 
+class QScxmlDataModelPrivate;
+class QScxmlTracer;
+
 namespace QScxmlExecutableContent {
 
 static inline bool operator<(const EvaluatorInfo &ei1, const EvaluatorInfo &ei2)
@@ -526,9 +529,15 @@ public:
     bool execute(ContainerId ip, const QVariant &extraData = QVariant());
 
 private:
-    bool step(Instructions &ip);
+    bool run(Instructions ip, Instructions end);
+    void traceInstruction(Instructions ip);
 
     QScxmlStateMachine *stateMachine;
+
+    // Only valid during execute():
+    QScxmlDataModelPrivate *dataModel;
+    QScxmlTableData *tableData;
+    QScxmlTracer *tracer;
     QVariant extraData;
 };
 
@@ -0,0 +1,296 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the QtScxml module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "qscxmlexecutor_p.h"
+#include "qscxmlglobals_p.h"
+#include "qscxmlstatemachine_p.h"
+
+#include <QThread>
+
+QT_BEGIN_NAMESPACE
+
+/*!
+ * \class QScxmlExecutor
+ * \brief The QScxmlExecutor class runs many state machines on a fixed set of worker threads.
+ * \since 5.7
+ * \inmodule QtScxml
+ *
+ * A QScxmlStateMachine processes its events in the event loop of the thread it lives in. When a
+ * large number of independent state machines is hosted, for example one per session, running
+ * them all in one thread limits the throughput to one core, while giving each of them its own
+ * thread does not scale either. A QScxmlExecutor runs a fixed number of worker threads, each
+ * running an event loop, and spreads the state machines over them. Unless it is given a thread
+ * count of its own, an executor uses the worker threads that the module also uses for threaded
+ * invocations, so that several executors do not compete with more threads than there are cores.
+ *
+ * The worker thread of a state machine is chosen by its session ID, so the same session always
+ * ends up in the same thread. The state machine, and its data model if it has no parent, are
+ * moved to that thread by addStateMachine(). They are initialized and started there by start().
+ *
+ * The state machines keep their usual API: events can be submitted from any thread with
+ * QScxmlStateMachine::submitEvent() and are processed in the worker thread. Signals like
+ * QScxmlStateMachine::reachedStableState() and QScxmlStateMachine::finished() are emitted in the
+ * worker thread, and are delivered to receivers in other threads through queued connections.
+ * Events that are submitted after addStateMachine() but before the state machine has started are
+ * queued, and processed once it has entered its initial states.
+ *
+ * The executor takes ownership of the state machines added to it. As they live in the worker
+ * threads, they must not be deleted directly from any other thread; use QObject::deleteLater()
+ * instead. The state machines that are left when the executor is destroyed are deleted in their
+ * worker threads, and the destructor waits for that. An executor must therefore not be destroyed
+ * in one of its worker threads.
+ *
+ * \sa QScxmlInvokableScxmlServiceFactory::setThreaded()
+ */
+
+/*!
+ * \property QScxmlExecutor::threadCount
+ *
+ * \brief The number of worker threads of the executor.
+ */
+
+QScxmlInternal::WorkerThreads::WorkerThreads()
+    : m_next(0)
+{
+    const int count = qMax(QThread::idealThreadCount(), 1);
+    for (int i = 0; i < count; ++i) {
+        QThread *thread = new QThread;
+        thread->setObjectName(QStringLiteral("QScxmlWorker%1").arg(i));
+        thread->start();
+        m_threads.append(thread);
+    }
+}
+
+QScxmlInternal::WorkerThreads::~WorkerThreads()
+{
+    foreach (QThread *thread, m_threads) {
+        thread->quit();
+        thread->wait();
+    }
+    qDeleteAll(m_threads);
+}
+
+Q_GLOBAL_STATIC(QScxmlInternal::WorkerThreads, sharedWorkerThreads)
+
+QScxmlInternal::WorkerThreads *QScxmlInternal::WorkerThreads::shared()
+{
+    return sharedWorkerThreads();
+}
+
+// Spreads the callers over the threads round-robin.
+QThread *QScxmlInternal::WorkerThreads::nextThread()
+{
+    QMutexLocker locker(&m_mutex);
+    QThread *thread = m_threads.at(m_next);
+    m_next = (m_next + 1) % m_threads.size();
+    return thread;
+}
+
+QScxmlExecutorPrivate::QScxmlExecutorPrivate()
+    : m_ownsThreads(false)
+{}
+
+void QScxmlExecutorPrivate::startThreads(int threadCount)
+{
+    if (threadCount <= 0) {
+        m_threads = QScxmlInternal::WorkerThreads::shared()->threads();
+        return;
+    }
+
+    m_ownsThreads = true;
+    m_threads.reserve(threadCount);
+    for (int i = 0; i < threadCount; ++i) {
+        QThread *thread = new QThread;
+        thread->setObjectName(QStringLiteral("QScxmlExecutor%1").arg(i));
+        thread->start();
+        m_threads.append(thread);
+    }
+}
+
+void QScxmlExecutorPrivate::stateMachineDestroyed(QObject *stateMachine)
+{
+    QMutexLocker locker(&m_stateMachinesMutex);
+    m_stateMachines.removeOne(static_cast<QScxmlStateMachine *>(stateMachine));
+    m_stateMachineDestroyed.wakeAll();
+}
+
+/*!
+ * Creates an executor with the parent object \a parent. It uses the worker threads that are shared
+ * within the module, one per core.
+ *
+ * \sa QThread::idealThreadCount(), QScxmlInvokableScxmlServiceFactory::setThreaded()
+ */
+QScxmlExecutor::QScxmlExecutor(QObject *parent)
+    : QObject(*new QScxmlExecutorPrivate, parent)
+{
+    Q_D(QScxmlExecutor);
+    d->startThreads(0);
+}
+
+/*!
+ * Creates an executor with \a threadCount worker threads of its own, with the parent object
+ * \a parent. If \a threadCount is not positive, the executor uses the shared worker threads, like
+ * the default constructor.
+ */
+QScxmlExecutor::QScxmlExecutor(int threadCount, QObject *parent)
+    : QObject(*new QScxmlExecutorPrivate, parent)
+{
+    Q_D(QScxmlExecutor);
+    d->startThreads(threadCount);
+}
+
+/*!
+ * Destroys the executor. The state machines that are still run by it are deleted, and the worker
+ * threads of its own are stopped.
+ */
+QScxmlExecutor::~QScxmlExecutor()
+{
+    Q_D(QScxmlExecutor);
+
+    {
+        // The worker threads may be shared, so they cannot be stopped to get rid of the state
+        // machines. Wait until each thread has deleted its own instead.
+        QMutexLocker locker(&d->m_stateMachinesMutex);
+        foreach (QScxmlStateMachine *stateMachine, d->m_stateMachines)
+            stateMachine->deleteLater();
+        while (!d->m_stateMachines.isEmpty())
+            d->m_stateMachineDestroyed.wait(&d->m_stateMachinesMutex);
+    }
+
+    if (d->m_ownsThreads) {
+        foreach (QThread *thread, d->m_threads) {
+            thread->quit();
+            thread->wait();
+        }
+        qDeleteAll(d->m_threads);
+    }
+}
+
+/*!
+ * Returns the number of worker threads.
+ */
+int QScxmlExecutor::threadCount() const
+{
+    Q_D(const QScxmlExecutor);
+    return d->m_threads.size();
+}
+
+/*!
+ * Returns the worker thread that runs the state machine with the session ID \a sessionId.
+ */
+QThread *QScxmlExecutor::threadForSession(const QString &sessionId) const
+{
+    Q_D(const QScxmlExecutor);
+    return d->m_threads.at(int(qHash(sessionId) % uint(d->m_threads.size())));
+}
+
+/*!
+ * Moves \a stateMachine to the worker thread for its session ID, and takes ownership of it.
+ * Returns \c true on success.
+ *
+ * The state machine must live in the thread that calls this method, it must not have a parent
+ * object, and it must not be running. Otherwise, \c false is returned and nothing is changed.
+ *
+ * \sa start() threadForSession()
+ */
+bool QScxmlExecutor::addStateMachine(QScxmlStateMachine *stateMachine)
+{
+    Q_D(QScxmlExecutor);
+
+    if (!stateMachine || stateMachine->thread() != QThread::currentThread()
+            || stateMachine->parent() || stateMachine->isRunning()) {
+        return false;
+    }
+
+    QThread *thread = threadForSession(stateMachine->sessionId());
+    {
+        QMutexLocker locker(&d->m_stateMachinesMutex);
+        if (d->m_stateMachines.contains(stateMachine))
+            return true;
+        d->m_stateMachines.append(stateMachine);
+    }
+
+    connect(stateMachine, &QObject::destroyed, this, [d](QObject *object) {
+        d->stateMachineDestroyed(object);
+    }, Qt::DirectConnection);
+
+    QScxmlDataModel *dataModel = stateMachine->dataModel();
+    stateMachine->moveToThread(thread);
+    if (dataModel && !dataModel->parent() && dataModel->thread() != thread)
+        dataModel->moveToThread(thread);
+
+    qscxmlTrace() << "running" << stateMachine << "in" << thread;
+    return true;
+}
+
+/*!
+ * Returns the state machines that are run by this executor.
+ */
+QVector<QScxmlStateMachine *> QScxmlExecutor::stateMachines() const
+{
+    Q_D(const QScxmlExecutor);
+    QMutexLocker locker(&d->m_stateMachinesMutex);
+    return d->m_stateMachines;
+}
+
+/*!
+ * Initializes and starts \a stateMachine in its worker thread, adding it to the executor first if
+ * necessary. Returns \c false if \a stateMachine could not be added.
+ *
+ * The state machine is started asynchronously. It emits
+ * QScxmlStateMachine::reachedStableState() once it has entered its initial states.
+ *
+ * \sa addStateMachine()
+ */
+bool QScxmlExecutor::start(QScxmlStateMachine *stateMachine)
+{
+    Q_D(QScxmlExecutor);
+
+    bool added;
+    {
+        QMutexLocker locker(&d->m_stateMachinesMutex);
+        added = d->m_stateMachines.contains(stateMachine);
+    }
+    if (!added && !addStateMachine(stateMachine))
+        return false;
+
+    return QMetaObject::invokeMethod(stateMachine, "start", Qt::QueuedConnection);
+}
+
+QT_END_NAMESPACE
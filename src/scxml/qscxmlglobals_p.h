@@ -60,6 +60,14 @@ QT_BEGIN_NAMESPACE
 Q_DECLARE_LOGGING_CATEGORY(qscxmlLog)
 Q_DECLARE_LOGGING_CATEGORY(scxmlLog)
 
+// The trace points of the interpreter. They sit in its innermost loops, so they can be compiled out
+// completely by building with CONFIG += scxml_no_trace. A QScxmlTracer is always available.
+#ifdef QSCXML_NO_TRACE
+#  define qscxmlTrace() QT_NO_QDEBUG_MACRO()
+#else
+#  define qscxmlTrace() qCDebug(qscxmlLog)
+#endif
+
 QT_END_NAMESPACE
 
 #endif // SCXMLGLOBALS_P_H
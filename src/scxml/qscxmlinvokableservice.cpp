@@ -37,10 +37,16 @@
 **
 ****************************************************************************/
 
+#include "qscxmldatamodel_p.h"
+#include "qscxmlevent_p.h"
+#include "qscxmlexecutor_p.h"
 #include "qscxmlglobals_p.h"
 #include "qscxmlinvokableservice.h"
 #include "qscxmlstatemachine_p.h"
 
+#include <QThread>
+#include <QTimer>
+
 QT_BEGIN_NAMESPACE
 
 class QScxmlInvokableService::Data
@@ -83,7 +89,7 @@ void QScxmlInvokableService::finalize()
 
     if (finalize != QScxmlExecutableContent::NoInstruction) {
         auto psm = parentStateMachine();
-        qCDebug(qscxmlLog) << psm << "running finalize on event";
+        qscxmlTrace() << psm << "running finalize on event";
         auto smp = QScxmlStateMachinePrivate::get(psm);
         smp->m_executionEngine->execute(finalize);
     }
@@ -110,6 +116,8 @@ public:
         , params(params)
         , finalize(finalize)
         , autoforward(autoforward)
+        , poolSize(0)
+        , threaded(false)
     {}
 
     QScxmlExecutableContent::StringId invokeLocation;
@@ -120,6 +128,11 @@ public:
     QVector<QScxmlInvokableServiceFactory::Param> params;
     QScxmlExecutableContent::ContainerId finalize;
     bool autoforward;
+    int poolSize;
+
+    // Only used by QScxmlInvokableScxmlServiceFactory.
+    QVector<QScxmlStateMachine *> pool;
+    bool threaded;
 };
 
 QScxmlInvokableServiceFactory::QScxmlInvokableServiceFactory(
@@ -132,9 +145,36 @@ QScxmlInvokableServiceFactory::QScxmlInvokableServiceFactory(
 
 QScxmlInvokableServiceFactory::~QScxmlInvokableServiceFactory()
 {
+    qDeleteAll(d->pool);
     delete d;
 }
 
+/*!
+ * Returns the maximum number of finished services that this factory keeps for reuse. The default
+ * is \c 0, which means that services are destroyed when they are canceled.
+ *
+ * \sa setPoolSize()
+ */
+int QScxmlInvokableServiceFactory::poolSize() const
+{
+    return d->poolSize;
+}
+
+/*!
+ * Sets the maximum number of finished services that this factory keeps for reuse to
+ * \a poolSize.
+ *
+ * When a state that invokes a service is entered and left at a high rate, creating and
+ * destroying the service each time can dominate the run time. With a pool, a finished service
+ * is reset and handed to the next invoke() instead. Factories that cannot reset their services
+ * ignore this setting. QScxmlInvokableScxmlServiceFactory recycles the child state machine,
+ * provided that it has finished and that its data model can be reset.
+ */
+void QScxmlInvokableServiceFactory::setPoolSize(int poolSize)
+{
+    d->poolSize = qMax(poolSize, 0);
+}
+
 QString QScxmlInvokableServiceFactory::calculateId(QScxmlStateMachine *parent, bool *ok) const
 {
     Q_ASSERT(ok);
@@ -171,7 +211,7 @@ QVariantMap QScxmlInvokableServiceFactory::calculateData(QScxmlStateMachine *par
 
         if (param.expr != QScxmlExecutableContent::NoEvaluator) {
             *ok = false;
-            auto v = dataModel->evaluateToVariant(param.expr, ok);
+            auto v = QScxmlDataModelPrivate::get(dataModel)->evaluateToVariant(param.expr, ok);
             if (!*ok)
                 return QVariantMap();
             result.insert(name, v);
@@ -235,12 +275,19 @@ QScxmlInvokableScxml::QScxmlInvokableScxml(QScxmlInvokableServiceFactory *servic
 
 QScxmlInvokableScxml::~QScxmlInvokableScxml()
 {
-    delete m_stateMachine;
+    if (m_stateMachine && m_stateMachine->thread() != QThread::currentThread()) {
+        // The child runs in a worker thread and may be in the middle of a macro step. Make sure it
+        // cannot reach the parent anymore, and let its own thread delete it.
+        QScxmlStateMachinePrivate::get(m_stateMachine)->detachFromParent();
+        m_stateMachine->deleteLater();
+    } else {
+        delete m_stateMachine;
+    }
 }
 
 bool QScxmlInvokableScxml::start()
 {
-    qCDebug(qscxmlLog) << parentStateMachine() << "preparing to start" << m_stateMachine;
+    qscxmlTrace() << parentStateMachine() << "preparing to start" << m_stateMachine;
 
     bool ok = false;
     auto id = service()->calculateId(parentStateMachine(), &ok);
@@ -251,14 +298,35 @@ bool QScxmlInvokableScxml::start()
         return false;
 
     m_stateMachine->setSessionId(id);
+    QScxmlStateMachinePrivate::get(parentStateMachine())->registerServiceId(this);
     m_stateMachine->setInitialValues(data);
+
+    if (m_stateMachine->thread() != QThread::currentThread()) {
+        // The data model of the child is initialized in the child's own thread. A failure there
+        // cannot be reported as the result of this call anymore, so it is posted to the parent.
+        QScxmlStateMachine *child = m_stateMachine;
+        qscxmlTrace() << parentStateMachine() << "starting" << child << "in" << child->thread();
+        QTimer::singleShot(0, child, [child]() {
+            if (child->init()) {
+                child->start();
+            } else {
+                qscxmlTrace() << "failed to start" << child;
+                QScxmlStateMachinePrivate::get(child)->postToParent(QScxmlEventBuilder::errorEvent(
+                        child, QStringLiteral("error.execution"),
+                        QStringLiteral("failed to initialize invoked state machine %1")
+                        .arg(child->name())));
+            }
+        });
+        return true;
+    }
+
     if (m_stateMachine->init()) {
-        qCDebug(qscxmlLog) << parentStateMachine() << "starting" << m_stateMachine;
+        qscxmlTrace() << parentStateMachine() << "starting" << m_stateMachine;
         m_stateMachine->start();
         return true;
     }
 
-    qCDebug(qscxmlLog) << parentStateMachine() << "failed to start" << m_stateMachine;
+    qscxmlTrace() << parentStateMachine() << "failed to start" << m_stateMachine;
     return false;
 }
 
@@ -282,6 +350,28 @@ QScxmlStateMachine *QScxmlInvokableScxml::stateMachine() const
     return m_stateMachine;
 }
 
+/*!
+ * \internal
+ * Hands the child state machine back to the factory that created it, if the factory keeps a pool
+ * and the state machine can be reused. Returns \c true if the state machine was taken; the service
+ * does not own it anymore then.
+ */
+bool QScxmlInvokableScxml::recycleStateMachine()
+{
+    auto factory = dynamic_cast<QScxmlInvokableScxmlServiceFactory *>(service());
+    if (!factory || !m_stateMachine || m_stateMachine->thread() != QThread::currentThread())
+        return false;
+
+    // A canceled child is still running, and stopping it runs its onexit handlers. Nothing
+    // they send may reach the parent anymore.
+    QScxmlStateMachinePrivate::get(m_stateMachine)->detachFromParent();
+    if (!factory->recycle(m_stateMachine))
+        return false;
+
+    m_stateMachine = Q_NULLPTR;
+    return true;
+}
+
 QScxmlInvokableScxmlServiceFactory::QScxmlInvokableScxmlServiceFactory(
         QScxmlExecutableContent::StringId invokeLocation,
         QScxmlExecutableContent::StringId id,
@@ -295,9 +385,75 @@ QScxmlInvokableScxmlServiceFactory::QScxmlInvokableScxmlServiceFactory(
                                    doAutoforward, params, finalize)
 {}
 
+/*!
+ * Returns \c true if the child state machines created by this factory run in worker threads.
+ * The default is \c false.
+ *
+ * \sa setThreaded()
+ */
+bool QScxmlInvokableScxmlServiceFactory::isThreaded() const
+{
+    return d->threaded;
+}
+
+/*!
+ * Sets whether the child state machines created by this factory run in worker threads to
+ * \a threaded.
+ *
+ * By default an invoked state machine lives in the thread of its parent, and all children of a
+ * parent share one event loop. A threaded child is moved to one of a set of worker threads, one
+ * per core, and processes its events there. The same threads run the state machines of a
+ * QScxmlExecutor that is not given a thread count of its own. Events between the parent and the
+ * child are then delivered through the event queues of the respective threads. The child is
+ * initialized asynchronously; if its data model fails to initialize, the child does not start,
+ * and an \c error.execution event is posted to the parent.
+ *
+ * Threaded children are never recycled, regardless of the poolSize().
+ */
+void QScxmlInvokableScxmlServiceFactory::setThreaded(bool threaded)
+{
+    d->threaded = threaded;
+}
+
+/*!
+ * \internal
+ * Stops and resets the state machine \a child of a finished or canceled invocation, and keeps it
+ * for the next invocation. Returns \c false if the pool is full or \a child cannot be reset; the
+ * caller destroys \a child then.
+ */
+bool QScxmlInvokableScxmlServiceFactory::recycle(QScxmlStateMachine *child)
+{
+    QVector<QScxmlStateMachine *> &pool = d->pool;
+    if (pool.size() >= poolSize())
+        return false;
+    if (!QScxmlStateMachinePrivate::get(child)->resetForReuse())
+        return false;
+
+    qscxmlTrace() << "keeping" << child << "for reuse";
+    pool.append(child);
+    return true;
+}
+
+/*!
+ * \internal
+ * Returns a recycled state machine, or \c nullptr if the pool is empty.
+ */
+QScxmlStateMachine *QScxmlInvokableScxmlServiceFactory::pooledStateMachine()
+{
+    QVector<QScxmlStateMachine *> &pool = d->pool;
+    return pool.isEmpty() ? Q_NULLPTR : pool.takeLast();
+}
+
 QScxmlInvokableService *QScxmlInvokableScxmlServiceFactory::finishInvoke(QScxmlStateMachine *child, QScxmlStateMachine *parent)
 {
     QScxmlStateMachinePrivate::get(child)->setIsInvoked(true);
+    if (isThreaded()) {
+        QThread *thread = QScxmlInternal::WorkerThreads::shared()->nextThread();
+        child->moveToThread(thread);
+        QScxmlDataModel *dataModel = child->dataModel();
+        if (dataModel && !dataModel->parent() && dataModel->thread() != thread)
+            dataModel->moveToThread(thread);
+    }
     return new QScxmlInvokableScxml(this, child, parent);
 }
 
@@ -50,6 +50,9 @@ QT_BEGIN_NAMESPACE
 class QScxmlEvent;
 class QScxmlStateMachine;
 class QScxmlInvokableServiceFactory;
+namespace QScxmlInternal {
+class WrappedQStateMachine;
+}
 
 class Q_SCXML_EXPORT QScxmlInvokableService
 {
@@ -111,6 +114,9 @@ public:
 
     virtual QScxmlInvokableService *invoke(QScxmlStateMachine *parent) = 0;
 
+    int poolSize() const;
+    void setPoolSize(int poolSize);
+
 public: // callbacks from the service:
     QString calculateId(QScxmlStateMachine *parent, bool *ok) const;
     QVariantMap calculateData(QScxmlStateMachine *parent, bool *ok) const;
@@ -118,6 +124,8 @@ public: // callbacks from the service:
     QScxmlExecutableContent::ContainerId finalizeContent() const;
 
 private:
+    friend class QScxmlInvokableScxmlServiceFactory;
+
     class Data;
     Data *d;
 };
@@ -138,6 +146,9 @@ public:
     QScxmlStateMachine *stateMachine() const;
 
 private:
+    friend class QScxmlInternal::WrappedQStateMachine;
+    bool recycleStateMachine();
+
     QScxmlStateMachine *m_stateMachine;
 };
 
@@ -153,8 +164,16 @@ public:
                                        const QVector<Param> &params,
                                        QScxmlExecutableContent::ContainerId finalize);
 
+    bool isThreaded() const;
+    void setThreaded(bool threaded);
+
 protected:
+    QScxmlStateMachine *pooledStateMachine();
     QScxmlInvokableService *finishInvoke(QScxmlStateMachine *child, QScxmlStateMachine *parent);
+
+private:
+    friend class QScxmlInvokableScxml;
+    bool recycle(QScxmlStateMachine *child);
 };
 
 QT_END_NAMESPACE
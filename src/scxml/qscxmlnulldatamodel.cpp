@@ -52,13 +52,21 @@ class QScxmlNullDataModelPrivate : public QScxmlDataModelPrivate
     struct ResolvedEvaluatorInfo {
         bool error;
         QString str;
+        int stateIndex;
 
         ResolvedEvaluatorInfo()
             : error(false)
+            , stateIndex(-1)
         {}
     };
 
 public:
+    bool reset() Q_DECL_OVERRIDE
+    {
+        // The resolved expressions only depend on the table data.
+        return true;
+    }
+
     bool evalBool(QScxmlExecutableContent::EvaluatorId id, bool *ok)
     {
         Q_Q(QScxmlNullDataModel);
@@ -68,6 +76,7 @@ public:
         Resolved::const_iterator it = resolved.find(id);
         if (it == resolved.end()) {
             info = prepare(id);
+            resolved.insert(id, info);
         } else {
             info = it.value();
         }
@@ -79,7 +88,7 @@ public:
         }
 
         *ok = true;
-        return q->stateMachine()->isActive(info.str);
+        return QScxmlStateMachinePrivate::get(q->stateMachine())->isActive(info.stateIndex);
     }
 
     ResolvedEvaluatorInfo prepare(QScxmlExecutableContent::EvaluatorId id)
@@ -101,6 +110,8 @@ public:
         if (expr.startsWith(QStringLiteral("In(")) && expr.endsWith(QLatin1Char(')'))) {
             resolved.error = false;
             resolved.str =  expr.mid(3, expr.length() - 4);
+            resolved.stateIndex = QScxmlStateMachinePrivate::get(q->stateMachine())->stateTable()
+                    .indexOf(resolved.str);
         } else {
             resolved.error = true;
             resolved.str =  QStringLiteral("%1 in %2").arg(expr, td->string(info.context));
@@ -54,7 +54,9 @@
 #include "qscxmlqstates.h"
 #include "qscxmldatamodel_p.h"
 #include "qscxmlstatemachine_p.h"
+#include "qscxmlevent_p.h"
 #include "qscxmlstatemachine.h"
+#include "qscxmlcompiledchart_p.h"
 
 #include <QState>
 #include <QHistoryState>
@@ -734,8 +736,45 @@ private:
     QVector<DocumentModel::Node *> m_parentNodes;
 };
 
+} // anonymous namespace
+
 #ifndef BUILD_QSCXMLC
-class QStateMachineBuilder;
+namespace QScxmlInternal {
+// The meta object of a dynamically created state machine, together with the tables needed to
+// dispatch calls to it. It is created once per compiled chart and shared by all instances.
+class DynamicMetaObject
+{
+public:
+    DynamicMetaObject()
+        : metaObject(Q_NULLPTR)
+        , firstSubStateMachineSignal(0)
+        , firstStateChangedSignal(0)
+        , firstSlot(0)
+        , firstSlotWithoutData(0)
+        , firstSubStateMachineProperty(0)
+    {}
+    ~DynamicMetaObject()
+    { free(metaObject); }
+
+    QMetaObject *metaObject;
+    QVector<QString> eventNamesByIndex;
+    QHash<QString, int> signalIndexByEventName;
+    QHash<QString, int> stateChangedSignalIndexByStateName;
+    QVector<QString> propertyNamesByIndex;
+    int firstSubStateMachineSignal;
+    int firstStateChangedSignal;
+    int firstSlot;
+    int firstSlotWithoutData;
+    int firstSubStateMachineProperty;
+
+private:
+    Q_DISABLE_COPY(DynamicMetaObject)
+};
+} // QScxmlInternal namespace
+
+namespace {
+using QScxmlInternal::DynamicMetaObject;
+
 class DynamicStateMachine: public QScxmlStateMachine, public QScxmlEventFilter
 {
     // Manually expanded from Q_OBJECT macro:
@@ -743,14 +782,15 @@ public:
     Q_OBJECT_CHECK
 
     const QMetaObject *metaObject() const Q_DECL_OVERRIDE
-    { return m_metaObject; }
+    { return m_meta->metaObject; }
 
     int qt_metacall(QMetaObject::Call _c, int _id, void **_a) Q_DECL_OVERRIDE
     {
         _id = QScxmlStateMachine::qt_metacall(_c, _id, _a);
         if (_id < 0)
             return _id;
-        int ownMethodCount = m_metaObject->methodCount() - m_metaObject->methodOffset();
+        const QMetaObject *mo = m_meta->metaObject;
+        int ownMethodCount = mo->methodCount() - mo->methodOffset();
         if (_c == QMetaObject::InvokeMetaMethod) {
             if (_id < ownMethodCount)
                 qt_static_metacall(this, _c, _id, _a);
@@ -758,7 +798,7 @@ public:
         } else if (_c == QMetaObject::ReadProperty || _c == QMetaObject::WriteProperty
                    || _c == QMetaObject::ResetProperty || _c == QMetaObject::RegisterPropertyMetaType) {
             qt_static_metacall(this, _c, _id, _a);
-            _id -= m_metaObject->propertyCount();
+            _id -= mo->propertyCount();
         }
         return _id;
     }
@@ -768,23 +808,24 @@ private:
     {
         if (_c == QMetaObject::InvokeMetaMethod) {
             DynamicStateMachine *_t = static_cast<DynamicStateMachine *>(_o);
-            if (_id >= _t->m_eventNamesByIndex.size() || _id < 0) {
+            const DynamicMetaObject *meta = _t->m_meta.data();
+            if (_id >= meta->eventNamesByIndex.size() || _id < 0) {
                 // out of bounds
                 return;
             }
-            if (_id >= _t->m_firstSubStateMachineSignal && _id < _t->m_firstSlot) {
+            if (_id >= meta->firstSubStateMachineSignal && _id < meta->firstSlot) {
                 // these signals are only emitted, not activated by another signal
                 return;
             }
-            if (_id >= _t->m_firstStateChangedSignal && _id < _t->m_firstSubStateMachineSignal) {
+            if (_id >= meta->firstStateChangedSignal && _id < meta->firstSubStateMachineSignal) {
                 // re-propagate QAbstractState::activeChanged as stateChanged
-                QMetaObject::activate(_t, _t->m_metaObject, _id, _a);
+                QMetaObject::activate(_t, meta->metaObject, _id, _a);
                 return;
             }
             // We have 1 kind of slots: those to submit events.
-            const QString &event = _t->m_eventNamesByIndex.at(_id);
+            const QString &event = meta->eventNamesByIndex.at(_id);
             if (!event.isEmpty()) {
-                if (_id < _t->m_firstSlotWithoutData) {
+                if (_id < meta->firstSlotWithoutData) {
                     QVariant data = *reinterpret_cast< QVariant(*)>(_a[1]);
                     if (data.canConvert<QJSValue>()) {
                         data = data.value<QJSValue>().toVariant();
@@ -796,23 +837,24 @@ private:
             }
         } else if (_c == QMetaObject::RegisterPropertyMetaType) {
             DynamicStateMachine *_t = static_cast<DynamicStateMachine *>(_o);
-            if (_id < _t->m_firstSubStateMachineProperty) {
+            if (_id < _t->m_meta->firstSubStateMachineProperty) {
                 *reinterpret_cast<int*>(_a[0]) = qRegisterMetaType<bool>();
             } else {
                 *reinterpret_cast<int*>(_a[0]) = qRegisterMetaType<QScxmlStateMachine *>();
             }
         } else if (_c == QMetaObject::ReadProperty) {
             DynamicStateMachine *_t = static_cast<DynamicStateMachine *>(_o);
+            const DynamicMetaObject *meta = _t->m_meta.data();
             void *_v = _a[0];
-            if (_id >= 0 && _id < _t->m_propertyNamesByIndex.size()) {
-                if (_id < _t->m_firstSubStateMachineProperty) {
+            if (_id >= 0 && _id < meta->propertyNamesByIndex.size()) {
+                if (_id < meta->firstSubStateMachineProperty) {
                     // getter for the state
                     auto smp = QScxmlStateMachinePrivate::get(_t);
-                    auto name = _t->m_propertyNamesByIndex.at(_id);
-                    *reinterpret_cast<bool*>(_v) = smp->stateByScxmlName(name)->active();
+                    auto name = meta->propertyNamesByIndex.at(_id);
+                    *reinterpret_cast<bool*>(_v) = smp->isActive(smp->stateTable().indexOf(name));
                 } else {
                     // getter for a child statemachine
-                    int idx = _id - _t->m_firstSubStateMachineProperty;
+                    int idx = _id - meta->firstSubStateMachineProperty;
                     *reinterpret_cast<QScxmlStateMachine **>(_v) = _t->m_subStateMachines.at(idx);
                 }
             }
@@ -820,37 +862,31 @@ private:
     }
     // end of Q_OBJECT macro
 
-private:
-    friend QStateMachineBuilder;
-    DynamicStateMachine()
-        : m_metaObject(Q_NULLPTR)
-        , m_firstSubStateMachineSignal(0)
-        , m_firstSlot(0)
-        , m_firstSlotWithoutData(0)
-        , m_firstSubStateMachineProperty(0)
+public:
+    DynamicStateMachine(const QSharedPointer<const DynamicMetaObject> &meta,
+                        const QSharedPointer<QScxmlExecutableContent::DynamicTableData> &tableData,
+                        BindingMethod dataBinding)
+        : m_meta(meta)
+        , m_tableData(tableData)
     {
-        // Temporarily wire up the QMetaObject, because qobject_cast needs it while building MyQStateMachine.
-        QMetaObjectBuilder b;
-        b.setClassName("DynamicStateMachine");
-        b.setSuperClass(&QScxmlStateMachine::staticMetaObject);
-        b.setStaticMetacallFunction(qt_static_metacall);
-        m_metaObject = b.toMetaObject();
-
+        m_subStateMachines.resize(meta->propertyNamesByIndex.size()
+                                  - meta->firstSubStateMachineProperty);
+        setDataBinding(dataBinding);
+        setTableData(tableData.data());
         setScxmlEventFilter(this);
     }
 
-    void initDynamicParts(const QSet<QString> &eventSignals,
-                          const QSet<QString> &eventSlots,
-                          const QList<QString> &stateNames,
-                          const QList<QString> &subStateMachineNames)
+    static QSharedPointer<const DynamicMetaObject> buildMetaObject(
+            const QSet<QString> &eventSignals, const QSet<QString> &eventSlots,
+            const QList<QString> &stateNames, const QList<QString> &subStateMachineNames)
     {
-        // Release the temporary QMetaObject.
-        Q_ASSERT(m_metaObject);
-        free(m_metaObject);
+        QSharedPointer<DynamicMetaObject> meta(new DynamicMetaObject);
+        QVector<QString> &eventNamesByIndex = meta->eventNamesByIndex;
+        QVector<QString> &propertyNamesByIndex = meta->propertyNamesByIndex;
 
-        m_eventNamesByIndex.reserve(eventSignals.size() + subStateMachineNames.size() + eventSlots.size());
+        eventNamesByIndex.reserve(eventSignals.size() + stateNames.size()
+                                  + subStateMachineNames.size() + 2 * eventSlots.size());
 
-        // Build the real one.
         QMetaObjectBuilder b;
         b.setClassName("DynamicStateMachine");
         b.setSuperClass(&QScxmlStateMachine::staticMetaObject);
@@ -862,108 +898,118 @@ private:
             QMetaMethodBuilder signalBuilder = b.addSignal(signalName);
             signalBuilder.setParameterNames(init("data"));
             int idx = signalBuilder.index();
-            m_eventNamesByIndex.resize(std::max(idx + 1, m_eventNamesByIndex.size()));
-            m_eventNamesByIndex[idx] = eventName;
+            eventNamesByIndex.resize(std::max(idx + 1, eventNamesByIndex.size()));
+            eventNamesByIndex[idx] = eventName;
+            meta->signalIndexByEventName.insert(eventName, idx);
         }
 
-        m_firstStateChangedSignal = m_eventNamesByIndex.size();
+        meta->firstStateChangedSignal = eventNamesByIndex.size();
         foreach (const QString &stateName, stateNames) {
             auto name = stateName.toUtf8();
             QByteArray signalName = name + "Changed(bool)";
             QMetaMethodBuilder signalBuilder = b.addSignal(signalName);
             signalBuilder.setParameterNames(init("active"));
             int idx = signalBuilder.index();
-            m_eventNamesByIndex.resize(std::max(idx + 1, m_eventNamesByIndex.size()));
+            eventNamesByIndex.resize(std::max(idx + 1, eventNamesByIndex.size()));
+            meta->stateChangedSignalIndexByStateName.insert(stateName, idx);
         }
 
-        m_firstSubStateMachineSignal = m_eventNamesByIndex.size();
+        meta->firstSubStateMachineSignal = eventNamesByIndex.size();
         foreach (const QString &machineName, subStateMachineNames) {
             auto name = machineName.toUtf8();
             QByteArray signalName = name + "Changed(QScxmlStateMachine *)";
             QMetaMethodBuilder signalBuilder = b.addSignal(signalName);
             signalBuilder.setParameterNames(init("statemachine"));
             int idx = signalBuilder.index();
-            m_eventNamesByIndex.resize(std::max(idx + 1, m_eventNamesByIndex.size()));
+            eventNamesByIndex.resize(std::max(idx + 1, eventNamesByIndex.size()));
         }
 
         // slots
-        m_firstSlot = m_eventNamesByIndex.size();
+        meta->firstSlot = eventNamesByIndex.size();
         foreach (const QString &eventName, eventSlots) {
             QByteArray slotName = eventName.toUtf8() + "(const QVariant &)";
             QMetaMethodBuilder slotBuilder = b.addSlot(slotName);
             slotBuilder.setParameterNames(init("data"));
             int idx = slotBuilder.index();
-            m_eventNamesByIndex.resize(std::max(idx + 1, m_eventNamesByIndex.size()));
-            m_eventNamesByIndex[idx] = eventName;
+            eventNamesByIndex.resize(std::max(idx + 1, eventNamesByIndex.size()));
+            eventNamesByIndex[idx] = eventName;
         }
 
-        m_firstSlotWithoutData = m_eventNamesByIndex.size();
+        meta->firstSlotWithoutData = eventNamesByIndex.size();
         foreach (const QString &eventName, eventSlots) {
             QByteArray slotName = eventName.toUtf8() + "()";
             QMetaMethodBuilder slotBuilder = b.addSlot(slotName);
             int idx = slotBuilder.index();
-            m_eventNamesByIndex.resize(std::max(idx + 1, m_eventNamesByIndex.size()));
-            m_eventNamesByIndex[idx] = eventName;
+            eventNamesByIndex.resize(std::max(idx + 1, eventNamesByIndex.size()));
+            eventNamesByIndex[idx] = eventName;
         }
 
         // properties
-        int stateNotifier = m_firstStateChangedSignal;
+        int stateNotifier = meta->firstStateChangedSignal;
         foreach (const QString &stateName, stateNames) {
             QMetaPropertyBuilder prop = b.addProperty(stateName.toUtf8(), "bool", stateNotifier);
             prop.setWritable(false);
             int idx = prop.index();
-            m_propertyNamesByIndex.resize(std::max(idx + 1, m_propertyNamesByIndex.size()));
-            m_propertyNamesByIndex[idx] = stateName;
+            propertyNamesByIndex.resize(std::max(idx + 1, propertyNamesByIndex.size()));
+            propertyNamesByIndex[idx] = stateName;
             ++stateNotifier;
         }
 
-        m_firstSubStateMachineProperty = m_propertyNamesByIndex.size();
-        int notifier = m_firstSubStateMachineSignal;
+        meta->firstSubStateMachineProperty = propertyNamesByIndex.size();
+        int notifier = meta->firstSubStateMachineSignal;
         foreach (const QString &machineName, subStateMachineNames) {
             QMetaPropertyBuilder prop = b.addProperty(machineName.toUtf8(), "QScxmlStateMachine *", notifier);
             prop.setWritable(false);
             int idx = prop.index();
-            m_propertyNamesByIndex.resize(std::max(idx + 1, m_propertyNamesByIndex.size()));
-            m_propertyNamesByIndex[idx] = machineName;
+            propertyNamesByIndex.resize(std::max(idx + 1, propertyNamesByIndex.size()));
+            propertyNamesByIndex[idx] = machineName;
             ++notifier;
         }
-        m_subStateMachines.resize(subStateMachineNames.size());
 
         // And we're done
-        m_metaObject = b.toMetaObject();
+        meta->metaObject = b.toMetaObject();
+        return meta;
     }
 
-public:
-    ~DynamicStateMachine()
-    { if (m_metaObject) free(m_metaObject); }
+    // Forwards QAbstractState::activeChanged of the state to the corresponding signal, if any.
+    void connectToStateChangedSignal(QAbstractState *state)
+    {
+        const int idx = m_meta->stateChangedSignalIndexByStateName.value(state->objectName(), -1);
+        if (idx == -1)
+            return;
+
+        static const QMetaMethod activeChanged
+                = QMetaMethod::fromSignal(&QAbstractState::activeChanged);
+        const QMetaObject *mo = m_meta->metaObject;
+        QObject::connect(state, activeChanged, this, mo->method(mo->methodOffset() + idx));
+    }
 
     bool handle(QScxmlEvent *event, QScxmlStateMachine *stateMachine) Q_DECL_OVERRIDE {
         Q_UNUSED(stateMachine);
 
-        if (event->originType() != QStringLiteral("qt:signal")) {
+        if (QScxmlEventPrivate::get(event)->originTypeAtom != QScxmlInternal::QtSignalTypeAtom) {
             return true;
         }
 
-        auto eventName = event->name();
-        for (int i = 0; i < m_firstSubStateMachineSignal; ++i) {
-            if (m_eventNamesByIndex.at(i) == eventName) {
-                QVariant data = event->data();
-                void *argv[] = { Q_NULLPTR, const_cast<void*>(reinterpret_cast<const void*>(&data)) };
-                QMetaObject::activate(this, metaObject(), i, argv);
-                return false;
-            }
-        }
+        const int i = m_meta->signalIndexByEventName.value(event->name(), -1);
+        if (i == -1)
+            return true;
 
-        return true;
+        QVariant data = event->data();
+        void *argv[] = { Q_NULLPTR, const_cast<void*>(reinterpret_cast<const void*>(&data)) };
+        QMetaObject::activate(this, metaObject(), i, argv);
+        return false;
     }
 
 protected:
     void setService(const QString &id, QScxmlInvokableService *service) Q_DECL_OVERRIDE
     {
+        const QVector<QString> &propertyNamesByIndex = m_meta->propertyNamesByIndex;
+        const int firstSubStateMachineProperty = m_meta->firstSubStateMachineProperty;
         int idx = -1;
-        for (int i = m_firstSubStateMachineProperty, ei = m_propertyNamesByIndex.size(); i != ei; ++i) {
-            if (m_propertyNamesByIndex.at(i) == id) {
-                idx = i - m_firstSubStateMachineProperty;
+        for (int i = firstSubStateMachineProperty, ei = propertyNamesByIndex.size(); i != ei; ++i) {
+            if (propertyNamesByIndex.at(i) == id) {
+                idx = i - firstSubStateMachineProperty;
                 break;
             }
         }
@@ -975,7 +1021,7 @@ protected:
             m_subStateMachines[idx] = machine;
             // emit changed signal:
             void *argv[] = { Q_NULLPTR, const_cast<void*>(reinterpret_cast<const void*>(&machine)) };
-            QMetaObject::activate(this, metaObject(), m_firstSubStateMachineSignal + idx, argv);
+            QMetaObject::activate(this, metaObject(), m_meta->firstSubStateMachineSignal + idx, argv);
         }
     }
 
@@ -990,15 +1036,9 @@ private:
     }
 
 private:
-    QMetaObject *m_metaObject;
-    QVector<QString> m_eventNamesByIndex;
-    QVector<QString> m_propertyNamesByIndex;
+    QSharedPointer<const DynamicMetaObject> m_meta;
+    QSharedPointer<QScxmlExecutableContent::DynamicTableData> m_tableData;
     QVector<QScxmlStateMachine *> m_subStateMachines;
-    int m_firstSubStateMachineSignal;
-    int m_firstStateChangedSignal;
-    int m_firstSlot;
-    int m_firstSlotWithoutData;
-    int m_firstSubStateMachineProperty;
 };
 
 class InvokeDynamicScxmlFactory: public QScxmlInvokableScxmlServiceFactory
@@ -1015,54 +1055,43 @@ public:
         : QScxmlInvokableScxmlServiceFactory(invokeLocation, id, idPrefix, idlocation, namelist, autoforward, params, finalize)
     {}
 
-    void setContent(const QSharedPointer<DocumentModel::ScxmlDocument> &content)
-    { m_content = content; }
+    void setChart(const QScxmlCompiledChart &chart)
+    { m_chart = chart; }
 
     QScxmlInvokableService *invoke(QScxmlStateMachine *child) Q_DECL_OVERRIDE;
 
 private:
-    QSharedPointer<DocumentModel::ScxmlDocument> m_content;
+    QScxmlCompiledChart m_chart;
 };
 
-class QStateMachineBuilder: public QScxmlExecutableContent::Builder
+// Generates the executable content of a document, and records which states and transitions have
+// to be created for each instance. No QObjects are created here.
+class ChartCompiler: public QScxmlExecutableContent::Builder
 {
 public:
-    QStateMachineBuilder()
-        : m_stateMachine(Q_NULLPTR)
-        , m_currentTransition(Q_NULLPTR)
+    ChartCompiler(QScxmlCompiledChartPrivate *chart)
+        : m_chart(chart)
+        , m_currentTransition(-1)
         , m_bindLate(false)
         , m_qtMode(false)
     {}
 
-    QScxmlStateMachine *build(DocumentModel::ScxmlDocument *doc)
+    void compile(DocumentModel::ScxmlDocument *doc)
     {
-        m_stateMachine = Q_NULLPTR;
         m_parents.reserve(32);
-        m_allTransitions.reserve(doc->allTransitions.size());
-        m_docStatesToQStates.reserve(doc->allStates.size());
+        m_transitionNodes.reserve(doc->allTransitions.size());
+        m_docStatesToIndexes.reserve(doc->allStates.size());
+        m_chart->states.reserve(doc->allStates.size());
+        m_chart->transitions.reserve(doc->allTransitions.size());
         m_qtMode = doc->qtMode;
 
         doc->root->accept(this);
         wireTransitions();
         applyInitialStates();
 
-        QScxmlExecutableContent::DynamicTableData *td = tableData();
-        td->setParent(m_stateMachine);
-        m_stateMachine->setTableData(td);
-        m_stateMachine->initDynamicParts(m_eventSignals, m_eventSlots, m_stateNames.keys(), m_subStateMachineNames.toList());
-
-        const auto signalCode = QByteArray::number(QSIGNAL_CODE);
-        for (auto it = m_stateNames.constBegin(), eit = m_stateNames.constEnd(); it != eit; ++it) {
-            QByteArray signal = signalCode + it.key().toUtf8() + "Changed(bool)";
-            QObject::connect(it.value(), SIGNAL(activeChanged(bool)), m_stateMachine, signal.constData());
-        }
-
-        m_parents.clear();
-        m_allTransitions.clear();
-        m_docStatesToQStates.clear();
-        m_currentTransition = Q_NULLPTR;
-
-        return m_stateMachine;
+        m_chart->tableData.reset(tableData());
+        m_chart->metaObject = DynamicStateMachine::buildMetaObject(
+                    m_eventSignals, m_eventSlots, m_stateNames, m_subStateMachineNames.toList());
     }
 
 private:
@@ -1071,14 +1100,12 @@ private:
 
     bool visit(DocumentModel::Scxml *node) Q_DECL_OVERRIDE
     {
-        m_stateMachine = new DynamicStateMachine;
-
         switch (node->binding) {
         case DocumentModel::Scxml::EarlyBinding:
-            m_stateMachine->setDataBinding(QScxmlStateMachine::EarlyBinding);
+            m_chart->lateBinding = false;
             break;
         case DocumentModel::Scxml::LateBinding:
-            m_stateMachine->setDataBinding(QScxmlStateMachine::LateBinding);
+            m_chart->lateBinding = true;
             m_bindLate = true;
             break;
         default:
@@ -1086,8 +1113,9 @@ private:
         }
 
         setName(node->name);
+        m_chart->dataModel = node->dataModel;
 
-        m_parents.append(QScxmlStateMachinePrivate::get(m_stateMachine)->m_qStateMachine);
+        m_parents.append(-1);
         visit(node->children);
 
         m_dataElements.append(node->dataElements);
@@ -1105,7 +1133,7 @@ private:
 
         foreach (auto initialState, node->initialStates) {
             Q_ASSERT(initialState);
-            m_initialStates.append(qMakePair(QScxmlStateMachinePrivate::get(m_stateMachine)->m_qStateMachine, initialState));
+            m_initialStates.append(qMakePair(-1, initialState));
         }
 
         return false;
@@ -1113,45 +1141,47 @@ private:
 
     bool visit(DocumentModel::State *node) Q_DECL_OVERRIDE
     {
-        QAbstractState *newState = Q_NULLPTR;
+        const int index = m_chart->states.size();
+        m_chart->states.append(QScxmlInternal::CompiledState());
+        m_chart->states[index].parent = m_parents.last();
+        m_chart->states[index].id = node->id;
+
         switch (node->type) {
-        case DocumentModel::State::Normal: {
-            auto s = new QScxmlState(currentParent());
-            newState = s;
+        case DocumentModel::State::Normal:
+            m_chart->states[index].kind = QScxmlInternal::CompiledState::Normal;
             foreach (DocumentModel::AbstractState *initialState, node->initialStates) {
-                m_initialStates.append(qMakePair(s, initialState));
+                m_initialStates.append(qMakePair(index, initialState));
             }
-        } break;
-        case DocumentModel::State::Parallel: {
-            auto s = new QScxmlState(currentParent());
-            s->setChildMode(QState::ParallelStates);
-            newState = s;
-        } break;
-        case DocumentModel::State::Initial: {
-            auto s = new QScxmlState(currentParent());
-            currentParent()->setInitialState(s);
-            newState = s;
-        } break;
+            break;
+        case DocumentModel::State::Parallel:
+            m_chart->states[index].kind = QScxmlInternal::CompiledState::Parallel;
+            break;
+        case DocumentModel::State::Initial:
+            m_chart->states[index].kind = QScxmlInternal::CompiledState::Initial;
+            break;
         case DocumentModel::State::Final: {
-            auto s = new QScxmlFinalState(currentParent());
-            newState = s;
-            s->setDoneData(generate(node->doneData));
+            m_chart->states[index].kind = QScxmlInternal::CompiledState::Final;
+            QScxmlExecutableContent::ContainerId doneData = generate(node->doneData);
+            m_chart->states[index].doneData = doneData;
         } break;
         default:
             Q_UNREACHABLE();
         }
 
-        newState->setObjectName(node->id);
-        m_stateNames.insert(node->id, newState);
+        if (!m_stateNameSet.contains(node->id)) {
+            m_stateNameSet.insert(node->id);
+            m_stateNames.append(node->id);
+        }
 
-        m_docStatesToQStates.insert(node, newState);
-        m_parents.append(newState);
+        m_docStatesToIndexes.insert(node, index);
+        m_parents.append(index);
 
         if (!node->dataElements.isEmpty()) {
             if (m_bindLate) {
-                qobject_cast<QScxmlState *>(newState)->setInitInstructions(startNewSequence());
+                QScxmlExecutableContent::ContainerId init = startNewSequence();
                 generate(node->dataElements);
                 endSequence();
+                m_chart->states[index].initInstructions = init;
             } else {
                 m_dataElements.append(node->dataElements);
             }
@@ -1159,52 +1189,43 @@ private:
 
         QScxmlExecutableContent::ContainerId onEntry = generate(node->onEntry);
         QScxmlExecutableContent::ContainerId onExit = generate(node->onExit);
-        if (QScxmlState *s = qobject_cast<QScxmlState *>(newState)) {
-            s->setOnEntryInstructions(onEntry);
-            s->setOnExitInstructions(onExit);
-            if (!node->invokes.isEmpty()) {
-                QVector<QScxmlInvokableServiceFactory *> factories;
-                foreach (DocumentModel::Invoke *invoke, node->invokes) {
-                    auto ctxt = createContext(QStringLiteral("invoke"));
-                    QVector<QScxmlExecutableContent::StringId> namelist;
-                    foreach (const QString &name, invoke->namelist)
-                        namelist += addString(name);
-                    QVector<QScxmlInvokableServiceFactory::Param> params;
-                    foreach (DocumentModel::Param *param, invoke->params) {
-                        QScxmlInvokableServiceFactory::Param p;
-                        p.name = addString(param->name);
-                        p.expr = createEvaluatorVariant(QStringLiteral("param"), QStringLiteral("expr"), param->expr);
-                        p.location = addString(param->location);
-                        params.append(p);
-                    }
-                    QScxmlExecutableContent::ContainerId finalize = QScxmlExecutableContent::NoInstruction;
-                    if (!invoke->finalize.isEmpty()) {
-                        finalize = startNewSequence();
-                        visit(&invoke->finalize);
-                        endSequence();
-                    }
-                    auto factory = new InvokeDynamicScxmlFactory(ctxt,
-                                                                 addString(invoke->id),
-                                                                 addString(node->id + QStringLiteral(".session-")),
-                                                                 addString(invoke->idLocation),
-                                                                 namelist,
-                                                                 invoke->autoforward,
-                                                                 params,
-                                                                 finalize);
-                    factory->setContent(invoke->content);
-                    factories.append(factory);
-                    QString name = invoke->content->root->name;
-                    if (!name.isEmpty()) {
-                        m_subStateMachineNames.insert(name);
-                    }
+        m_chart->states[index].onEntry = onEntry;
+        m_chart->states[index].onExit = onExit;
+
+        if (node->type != DocumentModel::State::Final) {
+            foreach (DocumentModel::Invoke *invoke, node->invokes) {
+                QScxmlInternal::CompiledInvoke compiledInvoke;
+                compiledInvoke.invokeLocation = createContext(QStringLiteral("invoke"));
+                foreach (const QString &name, invoke->namelist)
+                    compiledInvoke.namelist += addString(name);
+                foreach (DocumentModel::Param *param, invoke->params) {
+                    QScxmlInvokableServiceFactory::Param p;
+                    p.name = addString(param->name);
+                    p.expr = createEvaluatorVariant(QStringLiteral("param"), QStringLiteral("expr"), param->expr);
+                    p.location = addString(param->location);
+                    compiledInvoke.params.append(p);
+                }
+                compiledInvoke.finalize = QScxmlExecutableContent::NoInstruction;
+                if (!invoke->finalize.isEmpty()) {
+                    compiledInvoke.finalize = startNewSequence();
+                    visit(&invoke->finalize);
+                    endSequence();
+                }
+                compiledInvoke.id = addString(invoke->id);
+                compiledInvoke.idPrefix = addString(node->id + QStringLiteral(".session-"));
+                compiledInvoke.idLocation = addString(invoke->idLocation);
+                compiledInvoke.autoforward = invoke->autoforward;
+                // The child is compiled once here, and only instantiated on each invocation.
+                compiledInvoke.chart = QScxmlCompiledChartPrivate::compile(invoke->content.data(),
+                                                                           QVector<QScxmlError>());
+
+                m_chart->states[index].invokes.append(m_chart->invokes.size());
+                m_chart->invokes.append(compiledInvoke);
+                QString name = invoke->content->root->name;
+                if (!name.isEmpty()) {
+                    m_subStateMachineNames.insert(name);
                 }
-                s->setInvokableServiceFactories(factories);
             }
-        } else if (QScxmlFinalState *f = qobject_cast<QScxmlFinalState *>(newState)) {
-            f->setOnEntryInstructions(onEntry);
-            f->setOnExitInstructions(onExit);
-        } else {
-            Q_UNREACHABLE();
         }
 
         visit(node->children);
@@ -1219,58 +1240,62 @@ private:
             m_eventSlots.unite(node->events.toSet());
         }
 
-        auto newTransition = new QScxmlTransition(node->events);
-        if (QHistoryState *parent = qobject_cast<QHistoryState*>(m_parents.last())) {
-            parent->setDefaultTransition(newTransition);
-        } else {
-            currentParent()->addTransition(newTransition);
-        }
+        const int index = m_chart->transitions.size();
+        m_chart->transitions.append(QScxmlInternal::CompiledTransition());
+        m_transitionNodes.append(node);
+
+        const int source = m_parents.last();
+        m_chart->transitions[index].source = source;
+        m_chart->transitions[index].isHistoryDefault = isHistoryState(source);
+        m_chart->transitions[index].events = node->events;
 
         if (node->condition) {
             auto cond = createEvaluatorBool(QStringLiteral("transition"), QStringLiteral("cond"), *node->condition.data());
-            newTransition->setConditionalExpression(cond);
+            m_chart->transitions[index].condition = cond;
         }
 
         switch (node->type) {
         case DocumentModel::Transition::External:
-            newTransition->setTransitionType(QAbstractTransition::ExternalTransition);
+            m_chart->transitions[index].isInternal = false;
             break;
         case DocumentModel::Transition::Internal:
-            newTransition->setTransitionType(QAbstractTransition::InternalTransition);
+            m_chart->transitions[index].isInternal = true;
             break;
         default:
             Q_UNREACHABLE();
         }
 
-        m_allTransitions.insert(newTransition, node);
         if (!node->instructionsOnTransition.isEmpty()) {
-            m_currentTransition = newTransition;
-            newTransition->setInstructionsOnTransition(startNewSequence());
+            m_currentTransition = index;
+            QScxmlExecutableContent::ContainerId instructions = startNewSequence();
             visit(&node->instructionsOnTransition);
             endSequence();
-            m_currentTransition = 0;
+            m_chart->transitions[index].instructions = instructions;
+            m_currentTransition = -1;
         }
-        Q_ASSERT(newTransition->stateMachine());
         return false;
     }
 
     bool visit(DocumentModel::HistoryState *state) Q_DECL_OVERRIDE
     {
-        QHistoryState *newState = new QScxmlHistoryState(currentParent());
+        const int index = m_chart->states.size();
+        m_chart->states.append(QScxmlInternal::CompiledState());
+        m_chart->states[index].parent = m_parents.last();
+        m_chart->states[index].id = state->id;
+
         switch (state->type) {
         case DocumentModel::HistoryState::Shallow:
-            newState->setHistoryType(QHistoryState::ShallowHistory);
+            m_chart->states[index].kind = QScxmlInternal::CompiledState::ShallowHistory;
             break;
         case DocumentModel::HistoryState::Deep:
-            newState->setHistoryType(QHistoryState::DeepHistory);
+            m_chart->states[index].kind = QScxmlInternal::CompiledState::DeepHistory;
             break;
         default:
             Q_UNREACHABLE();
         }
 
-        newState->setObjectName(state->id);
-        m_docStatesToQStates.insert(state, newState);
-        m_parents.append(newState);
+        m_docStatesToIndexes.insert(state, index);
+        m_parents.append(index);
         return true;
     }
 
@@ -1289,30 +1314,35 @@ private:
     }
 
 private: // Utility methods
-    QState *currentParent() const
+    bool isHistoryState(int index) const
     {
-        if (m_parents.isEmpty())
-            return Q_NULLPTR;
+        if (index < 0)
+            return false;
+        const QScxmlInternal::CompiledState::Kind kind = m_chart->states.at(index).kind;
+        return kind == QScxmlInternal::CompiledState::ShallowHistory
+                || kind == QScxmlInternal::CompiledState::DeepHistory;
+    }
 
-        QState *parent = qobject_cast<QState*>(m_parents.last());
-        Q_ASSERT(parent);
-        return parent;
+    QString stateName(int index) const
+    { return index < 0 ? QString() : m_chart->states.at(index).id; }
+
+    // The targets are only wired after all states are known, so they come from the document.
+    QString transitionName(int index) const
+    {
+        return QStringLiteral("%1 -> %2").arg(stateName(m_chart->transitions.at(index).source),
+                                              m_transitionNodes.at(index)->targets.join(QLatin1Char(',')));
     }
 
     void wireTransitions()
     {
-        for (QHash<QAbstractTransition *, DocumentModel::Transition*>::const_iterator i = m_allTransitions.begin(), ei = m_allTransitions.end(); i != ei; ++i) {
-            QList<QAbstractState *> targets;
-            targets.reserve(i.value()->targets.size());
-            foreach (DocumentModel::AbstractState *targetState, i.value()->targetStates) {
-                QAbstractState *target = m_docStatesToQStates.value(targetState);
-                Q_ASSERT(target);
+        for (int i = 0, ei = m_transitionNodes.size(); i != ei; ++i) {
+            QVector<int> &targets = m_chart->transitions[i].targets;
+            targets.reserve(m_transitionNodes.at(i)->targetStates.size());
+            foreach (DocumentModel::AbstractState *targetState, m_transitionNodes.at(i)->targetStates) {
+                const int target = m_docStatesToIndexes.value(targetState, -1);
+                Q_ASSERT(target != -1);
                 targets.append(target);
             }
-            i.key()->setTargetStates(targets);
-
-            if (DebugHelper_NameTransitions)
-                i.key()->setObjectName(QStringLiteral("%1 -> %2").arg(i.key()->parent()->objectName(), i.value()->targets.join(QStringLiteral(","))));
         }
     }
 
@@ -1320,22 +1350,23 @@ private: // Utility methods
     {
         foreach (const auto &init, m_initialStates) {
             Q_ASSERT(init.second);
-            auto initialState = m_docStatesToQStates.value(init.second);
-            Q_ASSERT(initialState);
-            init.first->setInitialState(initialState);
+            const int initialState = m_docStatesToIndexes.value(init.second, -1);
+            Q_ASSERT(initialState != -1);
+            m_chart->initialStates.append(qMakePair(init.first, initialState));
         }
     }
 
     QString createContextString(const QString &instrName) const Q_DECL_OVERRIDE
     {
-        if (m_currentTransition) {
+        if (m_currentTransition != -1) {
             QString state;
-            if (QState *s = m_currentTransition->sourceState()) {
-                state = QStringLiteral(" of state '%1'").arg(s->objectName());
+            const int source = m_chart->transitions.at(m_currentTransition).source;
+            if (!isHistoryState(source)) {
+                state = QStringLiteral(" of state '%1'").arg(stateName(source));
             }
-            return QStringLiteral("%1 instruction in transition %2 %3").arg(instrName, m_currentTransition->objectName(), state);
+            return QStringLiteral("%1 instruction in transition %2%3").arg(instrName, transitionName(m_currentTransition), state);
         } else {
-            return QStringLiteral("%1 instruction in state %2").arg(instrName, m_parents.last()->objectName());
+            return QStringLiteral("%1 instruction in state %2").arg(instrName, stateName(m_parents.last()));
         }
     }
 
@@ -1346,35 +1377,184 @@ private: // Utility methods
     }
 
 private:
-    DynamicStateMachine *m_stateMachine;
-    QVector<QAbstractState *> m_parents;
-    QHash<QAbstractTransition *, DocumentModel::Transition*> m_allTransitions;
-    QHash<DocumentModel::AbstractState *, QAbstractState *> m_docStatesToQStates;
-    QAbstractTransition *m_currentTransition;
-    QVector<QPair<QState *, DocumentModel::AbstractState *>> m_initialStates;
+    QScxmlCompiledChartPrivate *m_chart;
+    QVector<int> m_parents; // indexes of the states, -1 for the state machine itself
+    QVector<DocumentModel::Transition *> m_transitionNodes;
+    QHash<DocumentModel::AbstractState *, int> m_docStatesToIndexes;
+    int m_currentTransition;
+    QVector<QPair<int, DocumentModel::AbstractState *>> m_initialStates;
     bool m_bindLate;
     bool m_qtMode;
     QVector<DocumentModel::DataElement *> m_dataElements;
     QSet<QString> m_eventSignals;
     QSet<QString> m_eventSlots;
-    QHash<QString, QAbstractState *> m_stateNames;
+    QList<QString> m_stateNames;
+    QSet<QString> m_stateNameSet;
     QSet<QString> m_subStateMachineNames;
 };
 
 inline QScxmlInvokableService *InvokeDynamicScxmlFactory::invoke(QScxmlStateMachine *parent)
 {
-    auto child = QStateMachineBuilder().build(m_content.data());
+    QScxmlStateMachine *child = pooledStateMachine();
+    if (!child)
+        child = QScxmlCompiledChartPrivate::get(m_chart)->instantiate(true);
+    return finishInvoke(child, parent);
+}
+} // anonymous namespace
 
-    auto dm = QScxmlDataModelPrivate::instantiateDataModel(m_content->root->dataModel);
-    dm->setParent(child);
-    child->setDataModel(dm);
+QScxmlCompiledChart QScxmlCompiledChartPrivate::compile(DocumentModel::ScxmlDocument *doc,
+                                                        const QVector<QScxmlError> &errors)
+{
+    QScxmlCompiledChart chart;
+    QScxmlCompiledChartPrivate *d = chart.d.data();
+    d->errors = errors;
+    if (doc && doc->root)
+        ChartCompiler(d).compile(doc);
+    return chart;
+}
 
-    return finishInvoke(child, parent);
+QScxmlStateMachine *QScxmlCompiledChartPrivate::instantiate(bool withDataModel) const
+{
+    if (!tableData) {
+        class InvalidStateMachine: public QScxmlStateMachine {
+        public:
+            InvalidStateMachine()
+            {}
+        };
+
+        auto stateMachine = new InvalidStateMachine;
+        QScxmlStateMachinePrivate::get(stateMachine)->parserData()->m_errors = errors;
+        return stateMachine;
+    }
+
+    auto stateMachine = new DynamicStateMachine(metaObject, tableData,
+                                                lateBinding ? QScxmlStateMachine::LateBinding
+                                                            : QScxmlStateMachine::EarlyBinding);
+    QState *root = QScxmlStateMachinePrivate::get(stateMachine)->m_qStateMachine;
+
+    QVector<QAbstractState *> qStates;
+    qStates.reserve(states.size());
+    foreach (const QScxmlInternal::CompiledState &state, states) {
+        QState *parent = state.parent == -1 ? root : qobject_cast<QState *>(qStates.at(state.parent));
+        Q_ASSERT(parent);
+
+        QAbstractState *newState = Q_NULLPTR;
+        switch (state.kind) {
+        case QScxmlInternal::CompiledState::Normal:
+            newState = new QScxmlState(parent);
+            break;
+        case QScxmlInternal::CompiledState::Parallel: {
+            auto s = new QScxmlState(parent);
+            s->setChildMode(QState::ParallelStates);
+            newState = s;
+        } break;
+        case QScxmlInternal::CompiledState::Initial: {
+            auto s = new QScxmlState(parent);
+            parent->setInitialState(s);
+            newState = s;
+        } break;
+        case QScxmlInternal::CompiledState::Final: {
+            auto s = new QScxmlFinalState(parent);
+            s->setDoneData(state.doneData);
+            newState = s;
+        } break;
+        case QScxmlInternal::CompiledState::ShallowHistory:
+        case QScxmlInternal::CompiledState::DeepHistory: {
+            auto s = new QScxmlHistoryState(parent);
+            s->setHistoryType(state.kind == QScxmlInternal::CompiledState::ShallowHistory
+                              ? QHistoryState::ShallowHistory : QHistoryState::DeepHistory);
+            newState = s;
+        } break;
+        default:
+            Q_UNREACHABLE();
+        }
+
+        newState->setObjectName(state.id);
+        qStates.append(newState);
+
+        if (QScxmlState *s = qobject_cast<QScxmlState *>(newState)) {
+            if (state.initInstructions != QScxmlExecutableContent::NoInstruction)
+                s->setInitInstructions(state.initInstructions);
+            s->setOnEntryInstructions(state.onEntry);
+            s->setOnExitInstructions(state.onExit);
+            if (!state.invokes.isEmpty()) {
+                QVector<QScxmlInvokableServiceFactory *> factories;
+                factories.reserve(state.invokes.size());
+                foreach (int invokeIndex, state.invokes) {
+                    const QScxmlInternal::CompiledInvoke &invoke = invokes.at(invokeIndex);
+                    auto factory = new InvokeDynamicScxmlFactory(invoke.invokeLocation,
+                                                                 invoke.id,
+                                                                 invoke.idPrefix,
+                                                                 invoke.idLocation,
+                                                                 invoke.namelist,
+                                                                 invoke.autoforward,
+                                                                 invoke.params,
+                                                                 invoke.finalize);
+                    factory->setChart(invoke.chart);
+                    factories.append(factory);
+                }
+                s->setInvokableServiceFactories(factories);
+            }
+        } else if (QScxmlFinalState *f = qobject_cast<QScxmlFinalState *>(newState)) {
+            f->setOnEntryInstructions(state.onEntry);
+            f->setOnExitInstructions(state.onExit);
+        }
+
+        if (state.kind != QScxmlInternal::CompiledState::ShallowHistory
+                && state.kind != QScxmlInternal::CompiledState::DeepHistory) {
+            stateMachine->connectToStateChangedSignal(newState);
+        }
+    }
+
+    foreach (const QScxmlInternal::CompiledTransition &transition, transitions) {
+        auto newTransition = new QScxmlTransition(transition.events);
+        QAbstractState *source = transition.source == -1 ? root : qStates.at(transition.source);
+        if (transition.isHistoryDefault)
+            static_cast<QHistoryState *>(source)->setDefaultTransition(newTransition);
+        else
+            static_cast<QState *>(source)->addTransition(newTransition);
+
+        if (transition.condition != QScxmlExecutableContent::NoEvaluator)
+            newTransition->setConditionalExpression(transition.condition);
+        newTransition->setTransitionType(transition.isInternal
+                                         ? QAbstractTransition::InternalTransition
+                                         : QAbstractTransition::ExternalTransition);
+        if (transition.instructions != QScxmlExecutableContent::NoInstruction)
+            newTransition->setInstructionsOnTransition(transition.instructions);
+
+        QList<QAbstractState *> targets;
+        targets.reserve(transition.targets.size());
+        foreach (int target, transition.targets)
+            targets.append(qStates.at(target));
+        newTransition->setTargetStates(targets);
+
+        if (DebugHelper_NameTransitions) {
+            QStringList targetNames;
+            foreach (QAbstractState *target, targets)
+                targetNames.append(target->objectName());
+            newTransition->setObjectName(QStringLiteral("%1 -> %2").arg(source->objectName(), targetNames.join(QStringLiteral(","))));
+        }
+        Q_ASSERT(newTransition->stateMachine());
+    }
+
+    foreach (const auto &init, initialStates) {
+        QState *parent = init.first == -1 ? root : qobject_cast<QState *>(qStates.at(init.first));
+        Q_ASSERT(parent);
+        parent->setInitialState(qStates.at(init.second));
+    }
+
+    if (withDataModel) {
+        QScxmlDataModel *dm = QScxmlDataModelPrivate::instantiateDataModel(dataModel);
+        QScxmlStateMachinePrivate::get(stateMachine)->parserData()->m_ownedDataModel.reset(dm);
+        stateMachine->setDataModel(dm);
+        if (dm == Q_NULLPTR)
+            qWarning() << "No data-model instantiated";
+    }
+
+    return stateMachine;
 }
 #endif // BUILD_QSCXMLC
 
-} // anonymous namespace
-
 /*!
  * \class QScxmlParser
  * \brief The QScxmlParser class is a parser for SCXML files.
@@ -1491,20 +1671,8 @@ QScxmlStateMachine *QScxmlParser::instantiateStateMachine() const
 #ifdef BUILD_QSCXMLC
     return Q_NULLPTR;
 #else // BUILD_QSCXMLC
-    DocumentModel::ScxmlDocument *doc = d->scxmlDocument();
-    if (doc && doc->root) {
-        return QStateMachineBuilder().build(doc);
-    } else {
-        class InvalidStateMachine: public QScxmlStateMachine {
-        public:
-            InvalidStateMachine()
-            {}
-        };
-
-        auto stateMachine = new InvalidStateMachine;
-        QScxmlStateMachinePrivate::get(stateMachine)->parserData()->m_errors = errors();
-        return stateMachine;
-    }
+    QScxmlCompiledChart chart = QScxmlCompiledChart::fromParser(*this);
+    return QScxmlCompiledChartPrivate::get(chart)->instantiate(false);
 #endif // BUILD_QSCXMLC
 }
 
@@ -37,6 +37,7 @@
 **
 ****************************************************************************/
 
+#include "qscxmldatamodel_p.h"
 #include "qscxmlglobals_p.h"
 #include "qscxmlqstates_p.h"
 #include "qscxmlstatemachine_p.h"
@@ -67,6 +68,7 @@ static QStringList filterEmpty(const QStringList &events) {
 
 QScxmlStatePrivate::QScxmlStatePrivate()
     : initInstructions(QScxmlExecutableContent::NoInstruction)
+    , initInstructionsExecuted(false)
     , onEntryInstructions(QScxmlExecutableContent::NoInstruction)
     , onExitInstructions(QScxmlExecutableContent::NoInstruction)
 {}
@@ -135,9 +137,11 @@ void QScxmlState::onEntry(QEvent *event)
     Q_D(QScxmlState);
 
     auto sp = QScxmlStateMachinePrivate::get(stateMachine());
-    if (d->initInstructions != QScxmlExecutableContent::NoInstruction) {
+    sp->setActive(this, true);
+    if (d->initInstructions != QScxmlExecutableContent::NoInstruction
+            && !d->initInstructionsExecuted) {
         sp->m_executionEngine->execute(d->initInstructions);
-        d->initInstructions = QScxmlExecutableContent::NoInstruction;
+        d->initInstructionsExecuted = true;
     }
     QState::onEntry(event);
     auto sm = stateMachine();
@@ -158,8 +162,10 @@ void QScxmlState::onExit(QEvent *event)
 
     emit willExit();
     auto sm = stateMachine();
-    QScxmlStateMachinePrivate::get(sm)->m_executionEngine->execute(d->onExitInstructions);
+    auto smp = QScxmlStateMachinePrivate::get(sm);
+    smp->m_executionEngine->execute(d->onExitInstructions);
     QState::onExit(event);
+    smp->setActive(this, false);
 }
 
 QScxmlFinalStatePrivate::QScxmlFinalStatePrivate()
@@ -248,8 +254,9 @@ void QScxmlFinalState::onEntry(QEvent *event)
 {
     Q_D(QScxmlFinalState);
 
-    QFinalState::onEntry(event);
     auto smp = QScxmlStateMachinePrivate::get(stateMachine());
+    smp->setActive(this, true);
+    QFinalState::onEntry(event);
     smp->m_executionEngine->execute(d->onEntryInstructions);
 }
 
@@ -258,9 +265,16 @@ void QScxmlFinalState::onExit(QEvent *event)
     Q_D(QScxmlFinalState);
 
     QFinalState::onExit(event);
-    QScxmlStateMachinePrivate::get(stateMachine())->m_executionEngine->execute(d->onExitInstructions);
+    auto smp = QScxmlStateMachinePrivate::get(stateMachine());
+    smp->m_executionEngine->execute(d->onExitInstructions);
+    smp->setActive(this, false);
 }
 
+QScxmlBaseTransitionPrivate::QScxmlBaseTransitionPrivate()
+    : matchesAllEvents(false)
+    , eventDescriptorsCompiled(false)
+{}
+
 QScxmlBaseTransition::QScxmlBaseTransition(QState *sourceState, const QStringList &eventSelector)
     : QAbstractTransition(*new QScxmlBaseTransitionPrivate, sourceState)
 {
@@ -306,7 +320,18 @@ bool QScxmlBaseTransition::eventTest(QEvent *event)
     if (event->type() == QEvent::None)
         return false;
     Q_ASSERT(stateMachine());
-    QString eventName = QScxmlStateMachinePrivate::get(stateMachine())->m_event.name();
+    auto smp = QScxmlStateMachinePrivate::get(stateMachine());
+    if (d->eventDescriptorsCompiled) {
+        if (d->matchesAllEvents)
+            return true;
+        foreach (int descriptor, d->eventDescriptors) {
+            if (smp->isEventDescriptorMatched(descriptor))
+                return true;
+        }
+        return false;
+    }
+
+    QString eventName = smp->m_event.name();
     bool selected = false;
     foreach (QString eventStr, d->eventSelector) {
         if (eventStr == QStringLiteral("*")) {
@@ -368,13 +393,19 @@ bool QScxmlTransition::eventTest(QEvent *event)
 
 #ifdef DUMP_EVENT
     if (auto edm = dynamic_cast<QScxmlEcmaScriptDataModel *>(stateMachine()->dataModel()))
-        qCDebug(qscxmlLog) << qPrintable(edm->engine()->evaluate(QLatin1String("JSON.stringify(_event)")).toString());
+        qscxmlTrace() << qPrintable(edm->engine()->evaluate(QLatin1String("JSON.stringify(_event)")).toString());
 #endif
 
     if (QScxmlBaseTransition::eventTest(event)) {
         bool ok = true;
-        if (d->conditionalExp != QScxmlExecutableContent::NoEvaluator)
-            return stateMachine()->dataModel()->evaluateToBool(d->conditionalExp, &ok) && ok;
+        if (d->conditionalExp != QScxmlExecutableContent::NoEvaluator) {
+            QScxmlStateMachine *sm = stateMachine();
+            auto smp = QScxmlStateMachinePrivate::get(sm);
+            smp->trace(QScxmlTracer::GuardBegin, d->conditionalExp);
+            const bool met = QScxmlDataModelPrivate::get(sm->dataModel())->evaluateToBool(d->conditionalExp, &ok) && ok;
+            smp->trace(QScxmlTracer::GuardEnd, d->conditionalExp, met ? 1 : 0);
+            return met;
+        }
         return true;
     }
 
@@ -385,7 +416,13 @@ void QScxmlTransition::onTransition(QEvent *)
 {
     Q_D(QScxmlTransition);
 
-    QScxmlStateMachinePrivate::get(stateMachine())->m_executionEngine->execute(d->instructionsOnTransition);
+    auto smp = QScxmlStateMachinePrivate::get(stateMachine());
+    if (smp->m_tracer) {
+        QState *source = sourceState();
+        smp->trace(QScxmlTracer::TransitionTaken, smp->stateTable().indexOf(source),
+                   source->transitions().indexOf(this));
+    }
+    smp->m_executionEngine->execute(d->instructionsOnTransition);
 }
 
 QScxmlStateMachine *QScxmlTransition::stateMachine() const {
@@ -68,6 +68,8 @@ public:
 
     QScxmlInvokableService *invoke(QScxmlStateMachine *parent) Q_DECL_OVERRIDE
     {
+        if (QScxmlStateMachine *child = pooledStateMachine())
+            return finishInvoke(child, parent);
         return finishInvoke(new T, parent);
     }
 };
@@ -69,6 +69,7 @@ public:
     ~QScxmlStatePrivate();
 
     QScxmlExecutableContent::ContainerId initInstructions;
+    bool initInstructionsExecuted; // late binding: the data is initialized on the first entry only
     QScxmlExecutableContent::ContainerId onEntryInstructions;
     QScxmlExecutableContent::ContainerId onExitInstructions;
     QVector<QScxmlInvokableServiceFactory *> invokableServiceFactories;
@@ -96,7 +97,18 @@ class QScxmlBaseTransitionPrivate: public QAbstractTransitionPrivate
     Q_DECLARE_PUBLIC(QScxmlBaseTransition)
 
 public:
+    static QScxmlBaseTransitionPrivate *get(QScxmlBaseTransition *t) { return t ? t->d_func() : nullptr; }
+
+    QScxmlBaseTransitionPrivate();
+
     QStringList eventSelector;
+
+    // Filled in by QScxmlInternal::StateTable::build(): the ids of the event descriptors in the
+    // state machine's event trie. If the selector cannot be compiled, eventTest() falls back to
+    // matching the strings in eventSelector.
+    QVector<int> eventDescriptors;
+    bool matchesAllEvents;
+    bool eventDescriptorsCompiled;
 };
 
 class QScxmlTransitionPrivate: public QScxmlBaseTransitionPrivate
@@ -43,19 +43,27 @@
 #include "qscxmlinvokableservice.h"
 #include "qscxmlqstates_p.h"
 #include "qscxmldatamodel_p.h"
+#include "qscxmlcompiledchart.h"
 
 #include <QAbstractState>
 #include <QAbstractTransition>
+#include <QCoreApplication>
 #include <QFile>
 #include <QHash>
 #include <QJSEngine>
 #include <QLoggingCategory>
+#include <QMap>
+#include <QPair>
+#include <QQueue>
 #include <QState>
 #include <QString>
+#include <QThread>
+#include <QThreadStorage>
 #include <QTimer>
 
 #include <QtCore/private/qstatemachine_p.h>
 
+#include <algorithm>
 #include <functional>
 
 QT_BEGIN_NAMESPACE
@@ -72,6 +80,9 @@ public:
     WrappedQStateMachinePrivate(QScxmlStateMachine *stateMachine)
         : m_stateMachine(stateMachine)
         , m_queuedEvents(Q_NULLPTR)
+        , m_delayedEventCounter(0)
+        , m_delayedEventScheduler(Q_NULLPTR)
+        , m_delayedEventTimerDueTime(0)
     {}
     ~WrappedQStateMachinePrivate()
     {
@@ -82,10 +93,10 @@ public:
 
             delete m_queuedEvents;
         }
+        qDeleteAll(m_manualEvents);
+        qDeleteAll(m_delayedEvents);
     }
 
-    int eventIdForDelayedEvent(const QString &sendId);
-
     QScxmlStateMachine *stateMachine() const
     { return m_stateMachine; }
 
@@ -128,8 +139,194 @@ public: // fields
         QStateMachine::EventPriority priority;
     };
     QVector<QueuedEvent> *m_queuedEvents;
+
+    // Used when the state machine is processed manually: external events wait here until
+    // processEvents() is called.
+    QQueue<QScxmlEvent *> m_manualEvents;
+
+    // Delayed events are ordered by due time and submission order. Instead of one timer per event
+    // as in QStateMachine::postDelayedEvent(), the earliest due time is scheduled with the
+    // DelayedEventScheduler of the thread, and <cancel> finds the events by their send id.
+    typedef QPair<qint64, quint64> DelayedEventKey;
+    QMutex m_delayedEventsMutex; // protects the three fields below
+    QMap<DelayedEventKey, QScxmlEvent *> m_delayedEvents;
+    QMultiHash<QString, DelayedEventKey> m_delayedEventKeys;
+    quint64 m_delayedEventCounter;
+    // Only touched in the thread of the state machine:
+    DelayedEventScheduler *m_delayedEventScheduler; // set while the earliest due time is scheduled
+    qint64 m_delayedEventTimerDueTime;
 };
 
+// The state machines of one thread share a single timer for their delayed events. It is armed for
+// the earliest due time among them, so the number of timers does not grow with the number of
+// state machines.
+class DelayedEventScheduler: public QObject
+{
+public:
+    static DelayedEventScheduler *forCurrentThread();
+    ~DelayedEventScheduler();
+
+    void schedule(WrappedQStateMachine *stateMachine, qint64 interval);
+    void unschedule(WrappedQStateMachine *stateMachine);
+
+protected:
+    void timerEvent(QTimerEvent *event) Q_DECL_OVERRIDE;
+
+private:
+    DelayedEventScheduler();
+    void updateTimer();
+
+    QElapsedTimer m_clock;
+    QMultiMap<qint64, WrappedQStateMachine *> m_dueTimes;
+    QHash<WrappedQStateMachine *, qint64> m_dueTimeByStateMachine;
+    int m_timerId;
+    qint64 m_timerDueTime;
+};
+
+Q_GLOBAL_STATIC(QThreadStorage<DelayedEventScheduler *>, delayedEventSchedulers)
+
+DelayedEventScheduler::DelayedEventScheduler()
+    : m_timerId(0)
+    , m_timerDueTime(0)
+{
+    m_clock.start();
+}
+
+DelayedEventScheduler::~DelayedEventScheduler()
+{
+    // The thread exits. State machines still living in it cannot be scheduled anymore.
+    for (QHash<WrappedQStateMachine *, qint64>::const_iterator it = m_dueTimeByStateMachine.constBegin(),
+         eit = m_dueTimeByStateMachine.constEnd(); it != eit; ++it) {
+        it.key()->d_func()->m_delayedEventScheduler = Q_NULLPTR;
+    }
+}
+
+DelayedEventScheduler *DelayedEventScheduler::forCurrentThread()
+{
+    if (delayedEventSchedulers.isDestroyed())
+        return Q_NULLPTR;
+    QThreadStorage<DelayedEventScheduler *> *schedulers = delayedEventSchedulers();
+    if (!schedulers->hasLocalData())
+        schedulers->setLocalData(new DelayedEventScheduler);
+    return schedulers->localData();
+}
+
+void DelayedEventScheduler::schedule(WrappedQStateMachine *stateMachine, qint64 interval)
+{
+    unschedule(stateMachine);
+    const qint64 dueTime = m_clock.elapsed() + interval;
+    m_dueTimes.insert(dueTime, stateMachine);
+    m_dueTimeByStateMachine.insert(stateMachine, dueTime);
+    updateTimer();
+}
+
+// If the state machine was the earliest one, the timer fires for nothing and is rearmed then.
+void DelayedEventScheduler::unschedule(WrappedQStateMachine *stateMachine)
+{
+    QHash<WrappedQStateMachine *, qint64>::iterator it = m_dueTimeByStateMachine.find(stateMachine);
+    if (it == m_dueTimeByStateMachine.end())
+        return;
+    m_dueTimes.remove(it.value(), stateMachine);
+    m_dueTimeByStateMachine.erase(it);
+}
+
+void DelayedEventScheduler::updateTimer()
+{
+    if (m_timerId != 0) {
+        if (!m_dueTimes.isEmpty() && m_dueTimes.firstKey() == m_timerDueTime)
+            return;
+        killTimer(m_timerId);
+        m_timerId = 0;
+    }
+
+    if (m_dueTimes.isEmpty())
+        return;
+
+    m_timerDueTime = m_dueTimes.firstKey();
+    const qint64 interval = qMax(m_timerDueTime - m_clock.elapsed(), qint64(0));
+    m_timerId = startTimer(int(qMin(interval, qint64(INT_MAX))), Qt::PreciseTimer);
+}
+
+void DelayedEventScheduler::timerEvent(QTimerEvent *event)
+{
+    if (event->timerId() != m_timerId) {
+        QObject::timerEvent(event);
+        return;
+    }
+
+    killTimer(m_timerId);
+    m_timerId = 0;
+
+    // Handling a timeout runs arbitrary code, which can schedule, unschedule or delete other state
+    // machines. So take the due state machines out one at a time.
+    const qint64 now = m_clock.elapsed();
+    while (!m_dueTimes.isEmpty() && m_dueTimes.firstKey() <= now) {
+        QMultiMap<qint64, WrappedQStateMachine *>::iterator it = m_dueTimes.begin();
+        WrappedQStateMachine *stateMachine = it.value();
+        m_dueTimes.erase(it);
+        m_dueTimeByStateMachine.remove(stateMachine);
+        stateMachine->d_func()->m_delayedEventScheduler = Q_NULLPTR;
+        stateMachine->delayedEventTimeout();
+    }
+
+    updateTimer();
+}
+
+ForeignEventQueue::ForeignEventQueue()
+    : m_head(Q_NULLPTR)
+{}
+
+ForeignEventQueue::~ForeignEventQueue()
+{
+    foreach (const Entry &entry, takeAll())
+        delete entry.event;
+}
+
+/*!
+ * \internal
+ * Adds \a event to the queue. Can be called from any thread. Returns \c true if the queue was
+ * empty before, in which case the caller has to make sure that the consumer gets woken up.
+ */
+bool ForeignEventQueue::push(QScxmlEvent *event, bool submit)
+{
+    Node *node = new Node;
+    node->entry.event = event;
+    node->entry.submit = submit;
+
+    Node *head;
+    do {
+        head = m_head.loadAcquire();
+        node->next = head;
+    } while (!m_head.testAndSetRelease(head, node));
+
+    return head == Q_NULLPTR;
+}
+
+/*!
+ * \internal
+ * Removes all events from the queue, and returns them in the order they were pushed in. Must only
+ * be called from the consuming thread.
+ */
+QVector<ForeignEventQueue::Entry> ForeignEventQueue::takeAll()
+{
+    QVector<Entry> entries;
+    Node *node = m_head.fetchAndStoreAcquire(Q_NULLPTR);
+    while (node) {
+        entries.append(node->entry);
+        Node *next = node->next;
+        delete node;
+        node = next;
+    }
+    std::reverse(entries.begin(), entries.end());
+    return entries;
+}
+
+QEvent::Type ForeignEventQueue::wakeUpEventType()
+{
+    static const QEvent::Type type = QEvent::Type(QEvent::registerEventType());
+    return type;
+}
+
 WrappedQStateMachine::WrappedQStateMachine(QScxmlStateMachine *parent)
     : QStateMachine(*new WrappedQStateMachinePrivate(parent), parent)
 {}
@@ -138,6 +335,23 @@ WrappedQStateMachine::WrappedQStateMachine(WrappedQStateMachinePrivate &dd, QScx
     : QStateMachine(dd, parent)
 {}
 
+WrappedQStateMachine::~WrappedQStateMachine()
+{
+    Q_D(WrappedQStateMachine);
+    if (d->m_delayedEventScheduler)
+        d->m_delayedEventScheduler->unschedule(this);
+
+    // Invoked children running in worker threads post their events to this object. Cut them off
+    // before it goes away; the services themselves are only deleted later, together with the
+    // private object of the state machine.
+    foreach (QScxmlInvokableService *service, stateMachinePrivate()->invokedServices()) {
+        if (auto scxml = dynamic_cast<QScxmlInvokableScxml *>(service)) {
+            if (QScxmlStateMachine *child = scxml->stateMachine())
+                QScxmlStateMachinePrivate::get(child)->detachFromParent();
+        }
+    }
+}
+
 QScxmlStateMachine *WrappedQStateMachine::stateMachine() const
 {
     Q_D(const WrappedQStateMachine);
@@ -172,6 +386,29 @@ QScxmlStateMachinePrivate *WrappedQStateMachine::stateMachinePrivate()
 QScxmlEventFilter::~QScxmlEventFilter()
 {}
 
+/*!
+ * \class QScxmlClock
+ * \brief The QScxmlClock class is an interface for the clock of a manually processed state
+ * machine.
+ * \since 5.7
+ * \inmodule QtScxml
+ *
+ * \sa QScxmlStateMachine::setClock(), QScxmlStateMachine::setManualProcessing()
+ */
+
+/*!
+ * Destroys the clock.
+ */
+QScxmlClock::~QScxmlClock()
+{}
+
+/*!
+ * \fn QScxmlClock::currentTime() const
+ *
+ * Returns the current time in milliseconds. The values have to increase monotonically, but their
+ * origin does not matter.
+ */
+
 /*!
  * \fn QScxmlEventFilter::handle(QScxmlEvent *event, QScxmlStateMachine *stateMachine)
  *
@@ -240,7 +477,13 @@ QScxmlStateMachinePrivate::QScxmlStateMachinePrivate()
     , m_qStateMachine(Q_NULLPTR)
     , m_eventFilter(Q_NULLPTR)
     , m_parentStateMachine(Q_NULLPTR)
-{}
+    , m_manualProcessing(false)
+    , m_clock(Q_NULLPTR)
+    , m_tracer(Q_NULLPTR)
+    , m_jsonDataParsing(QScxmlStateMachine::ParseAllJsonData)
+{
+    m_systemClock.start();
+}
 
 QScxmlStateMachinePrivate::~QScxmlStateMachinePrivate()
 {
@@ -268,27 +511,182 @@ void QScxmlStateMachinePrivate::setQStateMachine(QScxmlInternal::WrappedQStateMa
     m_qStateMachine = stateMachine;
 }
 
-static QAbstractState *findState(const QString &scxmlName, QStateMachine *parent)
+QScxmlInternal::StateTable::StateTable()
+    : m_eventDescriptorCount(0)
+    , m_built(false)
+{}
+
+void QScxmlInternal::StateTable::build(QState *root)
+{
+    m_states.clear();
+    m_parents.clear();
+    m_childCounts.clear();
+    m_indexByState.clear();
+    m_indexByName.clear();
+    m_eventTrie.clear();
+    m_eventTrie.append(EventTrieNode()); // the root node
+    m_eventDescriptorCount = 0;
+
+    compileTransitions(root);
+    addChildStates(root, -1);
+
+    m_states.squeeze();
+    m_parents.squeeze();
+    m_childCounts.squeeze();
+    m_eventDescriptorIds.clear();
+    m_built = true;
+}
+
+void QScxmlInternal::StateTable::compileTransitions(QState *state)
+{
+    foreach (QAbstractTransition *transition, state->transitions()) {
+        auto tp = QScxmlBaseTransitionPrivate::get(qobject_cast<QScxmlBaseTransition *>(transition));
+        if (!tp)
+            continue;
+
+        tp->eventDescriptors.clear();
+        tp->matchesAllEvents = false;
+        tp->eventDescriptorsCompiled = true;
+        foreach (const QString &descriptor, tp->eventSelector) {
+            if (descriptor == QStringLiteral("*")) {
+                tp->matchesAllEvents = true;
+            } else if (descriptor.contains(QLatin1Char('('))) {
+                // Not a plain dotted name, so leave it to the string matching in eventTest().
+                tp->eventDescriptors.clear();
+                tp->eventDescriptorsCompiled = false;
+                break;
+            } else {
+                tp->eventDescriptors.append(addEventDescriptor(descriptor));
+            }
+        }
+    }
+}
+
+int QScxmlInternal::StateTable::addEventDescriptor(const QString &descriptor)
 {
-    QList<QObject *> worklist;
-    worklist.reserve(parent->children().size() + parent->configuration().size());
-    worklist.append(parent);
+    QString name = descriptor;
+    if (name.endsWith(QStringLiteral(".*")))
+        name.chop(2);
+
+    QHash<QString, int>::const_iterator it = m_eventDescriptorIds.constFind(name);
+    if (it != m_eventDescriptorIds.constEnd())
+        return *it;
 
-    while (!worklist.isEmpty()) {
-        QObject *obj = worklist.takeLast();
-        if (QAbstractState *state = qobject_cast<QAbstractState *>(obj)) {
-            if (state->objectName() == scxmlName)
-                return state;
+    int node = 0;
+    foreach (const QString &segment, name.split(QLatin1Char('.'))) {
+        int child = m_eventTrie.at(node).children.value(segment, -1);
+        if (child == -1) {
+            child = m_eventTrie.size();
+            m_eventTrie.append(EventTrieNode());
+            m_eventTrie[node].children.insert(segment, child);
         }
-        worklist.append(obj->children());
+        node = child;
     }
 
-    return Q_NULLPTR;
+    const int id = m_eventDescriptorCount++;
+    m_eventTrie[node].descriptors.append(id);
+    m_eventDescriptorIds.insert(name, id);
+    return id;
+}
+
+/*!
+ * \internal
+ * Marks all event descriptors that match the event \a eventName in \a matchedDescriptors. The
+ * event name is split at the dots and walked down the trie once; everything after an opening
+ * parenthesis is ignored, like the old string-based matching did.
+ */
+void QScxmlInternal::StateTable::matchEvent(const QString &eventName,
+                                            QBitArray *matchedDescriptors) const
+{
+    matchedDescriptors->fill(false, m_eventDescriptorCount);
+    if (m_eventDescriptorCount == 0)
+        return;
+
+    int end = eventName.indexOf(QLatin1Char('('));
+    if (end == -1)
+        end = eventName.size();
+
+    int node = 0;
+    int segmentStart = 0;
+    for (;;) {
+        int segmentEnd = eventName.indexOf(QLatin1Char('.'), segmentStart);
+        if (segmentEnd == -1 || segmentEnd > end)
+            segmentEnd = end;
+
+        const QString segment = QString::fromRawData(eventName.constData() + segmentStart,
+                                                     segmentEnd - segmentStart);
+        node = m_eventTrie.at(node).children.value(segment, -1);
+        if (node == -1)
+            return;
+        foreach (int descriptor, m_eventTrie.at(node).descriptors)
+            matchedDescriptors->setBit(descriptor);
+
+        if (segmentEnd == end)
+            return;
+        segmentStart = segmentEnd + 1;
+    }
+}
+
+void QScxmlInternal::StateTable::addChildStates(QObject *parent, int parentIndex)
+{
+    foreach (QObject *child, parent->children()) {
+        QAbstractState *state = qobject_cast<QAbstractState *>(child);
+        if (!state)
+            continue;
+
+        const int stateIndex = m_states.size();
+        m_states.append(state);
+        m_parents.append(parentIndex);
+        m_childCounts.append(0);
+        if (parentIndex != -1)
+            ++m_childCounts[parentIndex];
+        if (QState *compoundState = qobject_cast<QState *>(state))
+            compileTransitions(compoundState);
+
+        m_indexByState.insert(state, stateIndex);
+        const QString name = state->objectName();
+        if (!name.isEmpty() && !m_indexByName.contains(name))
+            m_indexByName.insert(name, stateIndex);
+
+        addChildStates(state, stateIndex);
+    }
 }
 
 QAbstractState *QScxmlStateMachinePrivate::stateByScxmlName(const QString &scxmlName)
 {
-    return findState(scxmlName, m_qStateMachine);
+    const QScxmlInternal::StateTable &table = stateTable();
+    const int stateIndex = table.indexOf(scxmlName);
+    return stateIndex == -1 ? Q_NULLPTR : table.state(stateIndex);
+}
+
+/*!
+ * \internal
+ * Updates the active state bitset when \a state is entered or exited. This is called from the
+ * onEntry() and onExit() handlers of the states, so that In() gives the same answer as the
+ * QStateMachine configuration while executable content runs.
+ */
+void QScxmlStateMachinePrivate::setActive(const QAbstractState *state, bool active)
+{
+    const QScxmlInternal::StateTable &table = stateTable();
+    const int stateIndex = table.indexOf(state);
+    if (stateIndex == -1)
+        return;
+    trace(active ? QScxmlTracer::StateEntered : QScxmlTracer::StateExited, stateIndex);
+    if (m_activeStates.size() != table.stateCount())
+        m_activeStates.resize(table.stateCount());
+    m_activeStates.setBit(stateIndex, active);
+}
+
+/*!
+ * \internal
+ * Returns the flat state table of this state machine. The table is built on first use, after the
+ * states have been created by either the generated code or the QScxmlParser.
+ */
+const QScxmlInternal::StateTable &QScxmlStateMachinePrivate::stateTable() const
+{
+    if (!m_stateTable.isBuilt())
+        m_stateTable.build(m_qStateMachine);
+    return m_stateTable;
 }
 
 QScxmlStateMachinePrivate::ParserData *QScxmlStateMachinePrivate::parserData()
@@ -303,14 +701,31 @@ void QScxmlStateMachinePrivate::addService(QScxmlInvokableService *service)
     Q_Q(QScxmlStateMachine);
     Q_ASSERT(!m_invokedServices.contains(service));
     m_invokedServices.append(service);
+    if (service->autoforward())
+        m_autoforwardServices.append(service);
     q->setService(service->name(), service);
 }
 
+/*!
+ * \internal
+ * Registers the invoke id of \a service for routing. Services call this as soon as they have
+ * calculated their id. Services that do not are registered after they have been started.
+ */
+void QScxmlStateMachinePrivate::registerServiceId(QScxmlInvokableService *service)
+{
+    Q_ASSERT(m_invokedServices.contains(service));
+    const QString id = service->id();
+    if (!m_servicesById.contains(id, service))
+        m_servicesById.insert(id, service);
+}
+
 bool QScxmlStateMachinePrivate::removeService(QScxmlInvokableService *service)
 {
     Q_Q(QScxmlStateMachine);
     Q_ASSERT(m_invokedServices.contains(service));
     if (m_invokedServices.removeOne(service)) {
+        m_servicesById.remove(service->id(), service);
+        m_autoforwardServices.removeOne(service);
         q->setService(service->name(), Q_NULLPTR);
         return true;
     }
@@ -322,6 +737,46 @@ bool QScxmlStateMachinePrivate::executeInitialSetup()
     return m_executionEngine->execute(m_tableData->initialSetup());
 }
 
+/*!
+ * \internal
+ * Brings a state machine back to the state it had right after construction, so that it can be
+ * initialized and started again as a new session. A running state machine, like the child of a
+ * canceled invocation, is stopped first. The states, transitions and data model objects are kept.
+ *
+ * Returns \c false if the state machine cannot be stopped right away, still has services, or has
+ * a data model that cannot be reset. It may have been stopped then, but is not reset.
+ */
+bool QScxmlStateMachinePrivate::resetForReuse()
+{
+    Q_Q(QScxmlStateMachine);
+
+    if (!m_qStateMachine->stopImmediately() || !m_invokedServices.isEmpty())
+        return false;
+    if (m_dataModel && !QScxmlDataModelPrivate::get(m_dataModel)->reset())
+        return false;
+
+    m_qStateMachine->discardPendingEvents();
+    // Events that other threads submitted to the previous session must not reach the next one.
+    foreach (const QScxmlInternal::ForeignEventQueue::Entry &entry, m_foreignEvents.takeAll())
+        delete entry.event;
+    foreach (QScxmlState *state, m_qStateMachine->findChildren<QScxmlState *>())
+        QScxmlStatePrivate::get(state)->initInstructionsExecuted = false;
+    m_statesToInvoke.clear();
+    m_event.clear();
+    resetActiveStates();
+    clearMatchedEventDescriptors();
+
+    m_sessionId = QScxmlStateMachine::generateSessionId(QStringLiteral("session-"));
+    m_initialValues.clear();
+    m_parentStateMachine = Q_NULLPTR;
+    m_isInvoked = false;
+    if (m_isInitialized) {
+        m_isInitialized = false;
+        emit q->initializedChanged(false);
+    }
+    return true;
+}
+
 void QScxmlStateMachinePrivate::routeEvent(QScxmlEvent *event)
 {
     Q_Q(QScxmlStateMachine);
@@ -329,25 +784,22 @@ void QScxmlStateMachinePrivate::routeEvent(QScxmlEvent *event)
     if (!event)
         return;
 
-    QString origin = event->origin();
-    if (origin == QStringLiteral("#_parent")) {
-        if (auto psm = m_parentStateMachine) {
-            qCDebug(qscxmlLog) << q << "routing event" << event->name() << "from" << q->name() << "to parent" << psm->name();
-                                 QScxmlStateMachinePrivate::get(psm)->postEvent(event);
-        } else {
-            qCDebug(qscxmlLog) << this << "is not invoked, so it cannot route a message to #_parent";
-            delete event;
-        }
-    } else if (origin.startsWith(QStringLiteral("#_")) && origin != QStringLiteral("#_internal")) {
+    const QScxmlEventPrivate *ed = QScxmlEventPrivate::get(event);
+    if (ed->originAtom == QScxmlInternal::ParentTargetAtom) {
+        qscxmlTrace() << q << "routing event" << event->name() << "from" << q->name() << "to parent";
+        if (!postToParent(event))
+            qscxmlTrace() << this << "is not invoked, so it cannot route a message to #_parent";
+    } else if (ed->originAtom == QScxmlInternal::OtherAtom
+               && ed->origin.startsWith(QStringLiteral("#_"))) {
         // route to children
-        auto originId = origin.midRef(2);
-        foreach (QScxmlInvokableService *service, m_invokedServices) {
-            if (service->id() == originId) {
-                qCDebug(qscxmlLog) << q << "routing event" << event->name()
-                                  << "from" << q->name()
-                                  << "to parent" << service->id();
-                service->postEvent(new QScxmlEvent(*event));
-            }
+        const QString originId = ed->origin.mid(2);
+        for (auto it = m_servicesById.constFind(originId), eit = m_servicesById.constEnd();
+             it != eit && it.key() == originId; ++it) {
+            QScxmlInvokableService *service = it.value();
+            qscxmlTrace() << q << "routing event" << event->name()
+                         << "from" << q->name()
+                         << "to parent" << service->id();
+            service->postEvent(new QScxmlEvent(*event));
         }
         delete event;
     } else {
@@ -355,19 +807,139 @@ void QScxmlStateMachinePrivate::routeEvent(QScxmlEvent *event)
     }
 }
 
+/*!
+ * \internal
+ * \brief Posts \a events to this state machine, without routing them.
+ *
+ * All events are added to the event queues under a single lock, and the state machine is woken up
+ * once to process them all.
+ */
+void QScxmlStateMachinePrivate::postEvents(const QVector<QScxmlEvent *> &events)
+{
+    Q_Q(QScxmlStateMachine);
+
+    if (events.isEmpty())
+        return;
+
+    if (m_manualProcessing || QThread::currentThread() != q->thread()) {
+        foreach (QScxmlEvent *event, events)
+            postEvent(event);
+        return;
+    }
+
+    if (m_tracer) {
+        foreach (QScxmlEvent *event, events)
+            traceEvent(QScxmlTracer::EventEnqueued, event);
+    }
+
+    if (m_qStateMachine->isRunning()) {
+        qscxmlTrace() << q << "posting" << events.size() << "events";
+        m_qStateMachine->postEvents(events);
+    } else {
+        qscxmlTrace() << q << "queueing" << events.size() << "events";
+        foreach (QScxmlEvent *event, events) {
+            m_qStateMachine->queueEvent(event,
+                                        event->eventType() == QScxmlEvent::ExternalEvent
+                                        ? QStateMachine::NormalPriority
+                                        : QStateMachine::HighPriority);
+        }
+    }
+}
+
+/*!
+ * \internal
+ * Posts \a event to the parent state machine, which may live in another thread. Returns \c false,
+ * and deletes the event, if this state machine is not invoked or the parent has gone away.
+ */
+bool QScxmlStateMachinePrivate::postToParent(QScxmlEvent *event)
+{
+    QMutexLocker locker(&m_parentStateMachineMutex);
+    if (!m_parentStateMachine) {
+        delete event;
+        return false;
+    }
+
+    QScxmlStateMachinePrivate::get(m_parentStateMachine)->postEvent(event);
+    return true;
+}
+
+/*!
+ * \internal
+ * Makes sure that no more events are posted to the parent state machine.
+ */
+void QScxmlStateMachinePrivate::detachFromParent()
+{
+    QMutexLocker locker(&m_parentStateMachineMutex);
+    m_parentStateMachine = Q_NULLPTR;
+}
+
+/*!
+ * \internal
+ * Hands \a event, which is submitted from another thread, over to the thread of the state machine.
+ * If \a submit is \c true, the event is routed there as if passed to QScxmlStateMachine::submitEvent(),
+ * otherwise it is added to the event queues.
+ *
+ * Only the first event after the queue was drained wakes the state machine up, so a producer that
+ * submits events at a high rate only adds them to a lock-free list.
+ */
+void QScxmlStateMachinePrivate::postForeignEvent(QScxmlEvent *event, bool submit)
+{
+    if (m_foreignEvents.push(event, submit)) {
+        QCoreApplication::postEvent(m_qStateMachine,
+                                    new QEvent(QScxmlInternal::ForeignEventQueue::wakeUpEventType()));
+    }
+}
+
+/*!
+ * \internal
+ * Adds the events that were submitted from other threads to the event queues. The events that are
+ * already routed are added in batches.
+ */
+void QScxmlStateMachinePrivate::processForeignEvents()
+{
+    Q_Q(QScxmlStateMachine);
+
+    if (m_foreignEvents.isEmpty())
+        return;
+
+    QVector<QScxmlEvent *> batch;
+    foreach (const QScxmlInternal::ForeignEventQueue::Entry &entry, m_foreignEvents.takeAll()) {
+        if (entry.submit) {
+            postEvents(batch);
+            batch.clear();
+            q->submitEvent(entry.event);
+        } else {
+            batch.append(entry.event);
+        }
+    }
+    postEvents(batch);
+}
+
 void QScxmlStateMachinePrivate::postEvent(QScxmlEvent *event)
 {
     Q_Q(QScxmlStateMachine);
 
+    if (QThread::currentThread() != q->thread()) {
+        // Only the thread of the state machine may touch its queues. The event loop of that thread
+        // picks the event up and posts it again from there.
+        postForeignEvent(event, false);
+        return;
+    }
+
+    traceEvent(QScxmlTracer::EventEnqueued, event);
+
     QStateMachine::EventPriority priority =
             event->eventType() == QScxmlEvent::ExternalEvent ? QStateMachine::NormalPriority
                                                              : QStateMachine::HighPriority;
 
-    if (m_qStateMachine->isRunning()) {
-        qCDebug(qscxmlLog) << q << "posting event" << event->name();
+    if (m_manualProcessing) {
+        qscxmlTrace() << q << "queueing event" << event->name() << "for manual processing";
+        m_qStateMachine->postManualEvent(event, priority);
+    } else if (m_qStateMachine->isRunning()) {
+        qscxmlTrace() << q << "posting event" << event->name();
         m_qStateMachine->postEvent(event, priority);
     } else {
-        qCDebug(qscxmlLog) << q << "queueing event" << event->name();
+        qscxmlTrace() << q << "queueing event" << event->name();
         m_qStateMachine->queueEvent(event, priority);
     }
 }
@@ -384,7 +956,7 @@ void QScxmlStateMachinePrivate::postEvent(QScxmlEvent *event)
 void QScxmlStateMachinePrivate::submitError(const QString &type, const QString &msg, const QString &sendid)
 {
     Q_Q(QScxmlStateMachine);
-    qCDebug(qscxmlLog) << q << "had error" << type << ":" << msg;
+    qscxmlTrace() << q << "had error" << type << ":" << msg;
     if (!type.startsWith(QStringLiteral("error.")))
         qCWarning(qscxmlLog) << q << "Message type of error message does not start with 'error.'!";
     q->submitEvent(QScxmlEventBuilder::errorEvent(q, type, msg, sendid));
@@ -401,17 +973,7 @@ void QScxmlStateMachinePrivate::submitError(const QString &type, const QString &
  */
 QScxmlStateMachine *QScxmlStateMachine::fromFile(const QString &fileName)
 {
-    QFile scxmlFile(fileName);
-    if (!scxmlFile.open(QIODevice::ReadOnly)) {
-        auto stateMachine = new QScxmlStateMachine;
-        QScxmlError err(scxmlFile.fileName(), 0, 0, QStringLiteral("cannot open for reading"));
-        QScxmlStateMachinePrivate::get(stateMachine)->parserData()->m_errors.append(err);
-        return stateMachine;
-    }
-
-    QScxmlStateMachine *stateMachine = fromData(&scxmlFile, fileName);
-    scxmlFile.close();
-    return stateMachine;
+    return QScxmlCompiledChart::fromFile(fileName).instantiateStateMachine();
 }
 
 /*!
@@ -425,13 +987,7 @@ QScxmlStateMachine *QScxmlStateMachine::fromFile(const QString &fileName)
  */
 QScxmlStateMachine *QScxmlStateMachine::fromData(QIODevice *data, const QString &fileName)
 {
-    QXmlStreamReader xmlReader(data);
-    QScxmlParser parser(&xmlReader);
-    parser.setFileName(fileName);
-    parser.parse();
-    auto stateMachine = parser.instantiateStateMachine();
-    parser.instantiateDataModel(stateMachine);
-    return stateMachine;
+    return QScxmlCompiledChart::fromData(data, fileName).instantiateStateMachine();
 }
 
 /*!
@@ -512,6 +1068,19 @@ QScxmlStateMachine::QScxmlStateMachine(QScxmlStateMachinePrivate &dd, QObject *p
            before any executable content is executed.
  */
 
+/*!
+    \enum QScxmlStateMachine::JsonDataParsing
+
+    This enum specifies which string payloads the ECMAScript data model parses as JSON when a
+    script reads \c _event.data. Payloads that are not strings are never parsed.
+
+    \value ParseAllJsonData Every string payload that holds a JSON object or array is parsed.
+           This is the default.
+    \value ParseMarkedJsonData Only the payloads of events marked with QScxmlEvent::setJsonData()
+           are parsed.
+    \value ParseNoJsonData String payloads are always passed on as strings.
+ */
+
 /*!
  * Returns the session ID for the current state machine.
  *
@@ -655,28 +1224,30 @@ void QScxmlInternal::WrappedQStateMachine::beginSelectTransitions(QEvent *event)
     Q_D(WrappedQStateMachine);
 
     if (event && event->type() == QScxmlEvent::scxmlEventType) {
-        stateMachinePrivate()->m_event = *static_cast<QScxmlEvent *>(event);
-        d->stateMachine()->dataModel()->setScxmlEvent(stateMachinePrivate()->m_event);
-
         auto scxmlEvent = static_cast<QScxmlEvent *>(event);
         auto smp = stateMachinePrivate();
 
-        foreach (QScxmlInvokableService *service, smp->invokedServices()) {
-            if (scxmlEvent->invokeId() == service->id()) {
+        smp->m_event = *scxmlEvent;
+        smp->matchEventDescriptors(scxmlEvent->name());
+        d->stateMachine()->dataModel()->setScxmlEvent(smp->m_event);
+        smp->traceEvent(QScxmlTracer::EventDequeued, scxmlEvent);
+
+        const QString invokeId = scxmlEvent->invokeId();
+        if (!invokeId.isEmpty()) {
+            foreach (QScxmlInvokableService *service, smp->servicesById(invokeId))
                 service->finalize();
-            }
-            if (service->autoforward()) {
-                qCDebug(qscxmlLog) << this << "auto-forwarding event" << scxmlEvent->name()
-                                  << "from" << stateMachine()->name() << "to service" << service->id();
-                service->postEvent(new QScxmlEvent(*scxmlEvent));
-            }
+        }
+        foreach (QScxmlInvokableService *service, smp->autoforwardServices()) {
+            qscxmlTrace() << this << "auto-forwarding event" << scxmlEvent->name()
+                         << "from" << stateMachine()->name() << "to service" << service->id();
+            service->postEvent(new QScxmlEvent(*scxmlEvent));
         }
 
         if (scxmlEvent->eventType() == QScxmlEvent::ExternalEvent) {
             emit d->stateMachine()->eventOccurred(*scxmlEvent);
         }
 
-        if (scxmlEvent->originType() == QLatin1String("qt:signal")) {
+        if (QScxmlEventPrivate::get(scxmlEvent)->originTypeAtom == QScxmlInternal::QtSignalTypeAtom) {
             emit d->stateMachine()->externalEventOccurred(*scxmlEvent);
         }
 
@@ -684,10 +1255,12 @@ void QScxmlInternal::WrappedQStateMachine::beginSelectTransitions(QEvent *event)
             scxmlEvent->makeIgnorable();
             scxmlEvent->clear();
             smp->m_event.clear();
+            smp->clearMatchedEventDescriptors();
             return;
         }
     } else {
         stateMachinePrivate()->m_event.clear();
+        stateMachinePrivate()->clearMatchedEventDescriptors();
         d->stateMachine()->dataModel()->setScxmlEvent(stateMachinePrivate()->m_event);
     }
 }
@@ -696,10 +1269,12 @@ void QScxmlInternal::WrappedQStateMachine::beginMicrostep(QEvent *event)
 {
     Q_D(WrappedQStateMachine);
 
-    qCDebug(qscxmlLog) << d->m_stateMachine
-                      << "started microstep from state" << d->m_stateMachine->activeStateNames()
-                      << "with event" << stateMachinePrivate()->m_event.name()
-                      << "and event type" << event->type();
+    stateMachinePrivate()->traceEvent(QScxmlTracer::MicrostepBegin, &stateMachinePrivate()->m_event);
+
+    qscxmlTrace() << d->m_stateMachine
+                 << "started microstep from state" << d->m_stateMachine->activeStateNames()
+                 << "with event" << stateMachinePrivate()->m_event.name()
+                 << "and event type" << event->type();
 }
 
 void QScxmlInternal::WrappedQStateMachine::endMicrostep(QEvent *event)
@@ -707,68 +1282,74 @@ void QScxmlInternal::WrappedQStateMachine::endMicrostep(QEvent *event)
     Q_D(WrappedQStateMachine);
     Q_UNUSED(event);
 
-    qCDebug(qscxmlLog) << d->m_stateMachine
-                      << "finished microstep in state (" << d->m_stateMachine->activeStateNames() << ")";
+    stateMachinePrivate()->traceEvent(QScxmlTracer::MicrostepEnd, &stateMachinePrivate()->m_event);
+
+    qscxmlTrace() << d->m_stateMachine
+                 << "finished microstep in state (" << d->m_stateMachine->activeStateNames() << ")";
 }
 
-// This is a slightly modified copy of QStateMachinePrivate::event()
-// Instead of postExternalEvent and processEvents
-// we route event first to the appropriate state machine instance.
 bool QScxmlInternal::WrappedQStateMachine::event(QEvent *e)
 {
     Q_D(QScxmlInternal::WrappedQStateMachine);
-    if (e->type() == QEvent::Timer) {
-        QTimerEvent *te = static_cast<QTimerEvent*>(e);
-        int tid = te->timerId();
-        if (d->state != QStateMachinePrivate::Running) {
-            // This event has been cancelled already
-            QMutexLocker locker(&d->delayedEventsMutex);
-            Q_ASSERT(!d->timerIdToDelayedEventId.contains(tid));
-            return true;
-        }
-        d->delayedEventsMutex.lock();
-        int id = d->timerIdToDelayedEventId.take(tid);
-        QStateMachinePrivate::DelayedEvent ee = d->delayedEvents.take(id);
-        if (ee.event != 0) {
-            Q_ASSERT(ee.timerId == tid);
-//          killTimer(tid);
-//          d->delayedEventIdFreeList.release(id);
-            d->delayedEventsMutex.unlock();
-            d->_q_killDelayedEventTimer(id, tid);
-            // route here
-            if (ee.event->type() == QScxmlEvent::scxmlEventType)
-                QScxmlStateMachinePrivate::get(stateMachine())->routeEvent(static_cast<QScxmlEvent *>(ee.event));
-//          d->postExternalEvent(ee.event);
-//          d->processEvents(QStateMachinePrivate::DirectProcessing);
-            return true;
-        } else {
-            d->delayedEventsMutex.unlock();
-        }
+    if (e->type() == ForeignEventQueue::wakeUpEventType()) {
+        d->stateMachinePrivate()->processForeignEvents();
+        return true;
+    }
+    if (e->type() == QEvent::ThreadChange && d->m_delayedEventScheduler) {
+        // The scheduler belongs to the old thread. Schedule again once in the new one.
+        d->m_delayedEventScheduler->unschedule(this);
+        d->m_delayedEventScheduler = Q_NULLPTR;
+        QMetaObject::invokeMethod(this, "updateDelayedEventTimer", Qt::QueuedConnection);
     }
     return QState::event(e);
 }
 
+// Delayed events are not posted with QStateMachine::postDelayedEvent(). Due events are routed to
+// the appropriate state machine instance instead of being posted to this one.
+void QScxmlInternal::WrappedQStateMachine::delayedEventTimeout()
+{
+    Q_D(WrappedQStateMachine);
+    if (d->state == QStateMachinePrivate::Running)
+        routeDueDelayedEvents(d->stateMachinePrivate()->currentTime());
+    else
+        cancelAllDelayedScxmlEvents();
+    updateDelayedEventTimer();
+}
+
 void QScxmlInternal::WrappedQStateMachinePrivate::noMicrostep()
 {
-    qCDebug(qscxmlLog) << m_stateMachine
-                      << "had no transition, stays in state (" << m_stateMachine->activeStateNames() << ")";
+    qscxmlTrace() << m_stateMachine
+                 << "had no transition, stays in state (" << m_stateMachine->activeStateNames() << ")";
 }
 
 void QScxmlInternal::WrappedQStateMachinePrivate::processedPendingEvents(bool didChange)
 {
-    qCDebug(qscxmlLog) << m_stateMachine << "finishedPendingEvents" << didChange << "in state ("
-                      << m_stateMachine->activeStateNames() << ")";
+    qscxmlTrace() << m_stateMachine << "finishedPendingEvents" << didChange << "in state ("
+                 << m_stateMachine->activeStateNames() << ")";
     emit m_stateMachine->reachedStableState();
 }
 
 void QScxmlInternal::WrappedQStateMachinePrivate::beginMacrostep()
 {
+    stateMachinePrivate()->trace(QScxmlTracer::MacrostepBegin);
+
+    // Pick up what other threads submitted in the meantime, without waiting for the wake-up event
+    // to come through the event loop.
+    if (!stateMachinePrivate()->m_foreignEvents.isEmpty())
+        stateMachinePrivate()->processForeignEvents();
 }
 
 void QScxmlInternal::WrappedQStateMachinePrivate::endMacrostep(bool didChange)
 {
-    qCDebug(qscxmlLog) << m_stateMachine << "endMacrostep" << didChange
-                      << "in state (" << m_stateMachine->activeStateNames() << ")";
+    Q_Q(WrappedQStateMachine);
+
+    stateMachinePrivate()->trace(QScxmlTracer::MacrostepEnd);
+    qscxmlTrace() << m_stateMachine << "endMacrostep" << didChange
+                 << "in state (" << m_stateMachine->activeStateNames() << ")";
+
+    // The state machine was stopped or has finished.
+    if (state == QStateMachinePrivate::NotRunning)
+        q->cancelAllDelayedScxmlEvents();
 
     { // handle <invoke>s
         QVector<QScxmlState*> &sti = stateMachinePrivate()->m_statesToInvoke;
@@ -777,6 +1358,7 @@ void QScxmlInternal::WrappedQStateMachinePrivate::endMacrostep(bool didChange)
             auto sp = QScxmlStatePrivate::get(s);
             foreach (QScxmlInvokableService *s, sp->servicesWaitingToStart) {
                 s->start();
+                stateMachinePrivate()->registerServiceId(s);
             }
             sp->servicesWaitingToStart.clear();
         }
@@ -834,7 +1416,7 @@ void QScxmlInternal::WrappedQStateMachinePrivate::exitStates(
             ssp->servicesWaitingToStart.clear();
             QVector<QScxmlInvokableService *> &services = ssp->invokedServices;
             foreach (QScxmlInvokableService *service, services) {
-                qCDebug(qscxmlLog) << stateMachine() << "schedule service cancellation" << service->id();
+                qscxmlTrace() << stateMachine() << "schedule service cancellation" << service->id();
                 QMetaObject::invokeMethod(q_func(),
                                           "removeAndDestroyService",
                                           Qt::QueuedConnection,
@@ -864,12 +1446,12 @@ void QScxmlInternal::WrappedQStateMachinePrivate::exitInterpreter()
 
         if (QScxmlFinalState *finalState = qobject_cast<QScxmlFinalState *>(s)) {
             if (finalState->parent() == q) {
-                if (auto psm = stateMachinePrivate()->m_parentStateMachine) {
+                if (stateMachinePrivate()->m_isInvoked) {
                     auto done = new QScxmlEvent;
                     done->setName(QStringLiteral("done.invoke.") + m_stateMachine->sessionId());
                     done->setInvokeId(m_stateMachine->sessionId());
-                    qCDebug(qscxmlLog) << "submitting event" << done->name() << "to" << psm->name();
-                    psm->submitEvent(done);
+                    qscxmlTrace() << "submitting event" << done->name() << "to parent";
+                    stateMachinePrivate()->postToParent(done);
                 }
             }
         }
@@ -893,23 +1475,14 @@ void QScxmlInternal::WrappedQStateMachinePrivate::startupHook()
 {
     Q_Q(WrappedQStateMachine);
 
-    q->submitQueuedEvents();
-}
-
-int QScxmlInternal::WrappedQStateMachinePrivate::eventIdForDelayedEvent(const QString &sendId)
-{
-    QMutexLocker locker(&delayedEventsMutex);
+    // _q_start() has just cleared the configuration, so do the same with our bitset.
+    stateMachinePrivate()->stateTable();
+    stateMachinePrivate()->resetActiveStates();
 
-    QHash<int, DelayedEvent>::const_iterator it;
-    for (it = delayedEvents.constBegin(); it != delayedEvents.constEnd(); ++it) {
-        if (QScxmlEvent *e = dynamic_cast<QScxmlEvent *>(it->event)) {
-            if (e->sendId() == sendId) {
-                return it.key();
-            }
-        }
-    }
+    // Delayed events do not survive a restart.
+    q->cancelAllDelayedScxmlEvents();
 
-    return -1;
+    q->submitQueuedEvents();
 }
 
 /*!
@@ -925,18 +1498,12 @@ QStringList QScxmlStateMachine::stateNames(bool compress) const
 {
     Q_D(const QScxmlStateMachine);
 
-    QList<QObject *> worklist;
-    worklist.reserve(d->m_qStateMachine->children().size() + d->m_qStateMachine->configuration().size());
-    worklist.append(d->m_qStateMachine->children());
-
+    const QScxmlInternal::StateTable &table = d->stateTable();
     QStringList res;
-    while (!worklist.isEmpty()) {
-        QObject *obj = worklist.takeLast();
-        if (QAbstractState *state = qobject_cast<QAbstractState *>(obj)) {
-            if (!compress || !obj->children().count())
-                res.append(state->objectName());
-            worklist.append(obj->children());
-        }
+    res.reserve(table.stateCount());
+    for (int i = 0, ei = table.stateCount(); i != ei; ++i) {
+        if (!compress || table.isLeaf(i))
+            res.append(table.state(i)->objectName());
     }
     std::sort(res.begin(), res.end());
     return res;
@@ -953,13 +1520,24 @@ QStringList QScxmlStateMachine::activeStateNames(bool compress) const
 {
     Q_D(const QScxmlStateMachine);
 
-    QSet<QAbstractState *> config = QStateMachinePrivate::get(d->m_qStateMachine)->configuration;
-    if (compress)
-        foreach (const QAbstractState *s, config)
-            config.remove(s->parentState());
+    const QScxmlInternal::StateTable &table = d->stateTable();
+    const int stateCount = table.stateCount();
+
+    QBitArray hasActiveChild;
+    if (compress) {
+        hasActiveChild.resize(stateCount);
+        for (int i = 0; i != stateCount; ++i) {
+            const int parentIndex = table.parentIndex(i);
+            if (parentIndex != -1 && d->isActive(i))
+                hasActiveChild.setBit(parentIndex);
+        }
+    }
+
     QStringList res;
-    foreach (const QAbstractState *s, config) {
-        QString id = s->objectName();
+    for (int i = 0; i != stateCount; ++i) {
+        if (!d->isActive(i) || (compress && hasActiveChild.testBit(i)))
+            continue;
+        QString id = table.state(i)->objectName();
         if (!id.isEmpty()) {
             res.append(id);
         }
@@ -974,13 +1552,7 @@ QStringList QScxmlStateMachine::activeStateNames(bool compress) const
 bool QScxmlStateMachine::isActive(const QString &scxmlStateName) const
 {
     Q_D(const QScxmlStateMachine);
-    QSet<QAbstractState *> config = QStateMachinePrivate::get(d->m_qStateMachine)->configuration;
-    foreach (QAbstractState *s, config) {
-        if (s->objectName() == scxmlStateName) {
-            return true;
-        }
-    }
-    return false;
+    return d->isActive(d->stateTable().indexOf(scxmlStateName));
 }
 
 /*!
@@ -996,7 +1568,7 @@ QMetaObject::Connection QScxmlStateMachine::connectToState(const QString &scxmlS
                                             Qt::ConnectionType type)
 {
     Q_D(QScxmlStateMachine);
-    QAbstractState *state = findState(scxmlStateName, d->m_qStateMachine);
+    QAbstractState *state = d->stateByScxmlName(scxmlStateName);
     return QObject::connect(state, SIGNAL(activeChanged(bool)), receiver, method, type);
 }
 
@@ -1110,18 +1682,23 @@ void QScxmlStateMachine::submitEvent(QScxmlEvent *event)
     if (!event)
         return;
 
+    if (QThread::currentThread() != thread()) {
+        // Routing looks at the invoked services and the delayed events, which belong to the thread
+        // of the state machine. Let that thread do it.
+        d->postForeignEvent(event, true);
+        return;
+    }
+
     if (event->delay() > 0) {
-        qCDebug(qscxmlLog) << this << "submitting event" << event->name()
-                           << "with delay" << event->delay() << "ms:"
-                           << QScxmlEventPrivate::debugString(event).constData();
+        qscxmlTrace() << this << "submitting event" << event->name()
+                      << "with delay" << event->delay() << "ms:"
+                      << QScxmlEventPrivate::debugString(event).constData();
 
         Q_ASSERT(event->eventType() == QScxmlEvent::ExternalEvent);
-        int id = d->m_qStateMachine->postDelayedEvent(event, event->delay());
-
-        qCDebug(qscxmlLog) << this << ": delayed event" << event->name() << "(" << event << ") got id:" << id;
+        d->m_qStateMachine->postDelayedScxmlEvent(event, d->currentTime() + event->delay());
     } else {
-        qCDebug(qscxmlLog) << this << "submitting event" << event->name()
-                           << ":" << QScxmlEventPrivate::debugString(event).constData();
+        qscxmlTrace() << this << "submitting event" << event->name()
+                      << ":" << QScxmlEventPrivate::debugString(event).constData();
 
         d->routeEvent(event);
     }
@@ -1157,6 +1734,47 @@ void QScxmlStateMachine::submitEvent(const QString &eventName, const QVariant &d
     submitEvent(e);
 }
 
+/*!
+ * Submits all \a events in one go, and takes ownership of them.
+ *
+ * This is equivalent to calling submitEvent() for each of the events in order, but the events that
+ * are meant for this state machine are added to its event queue at once, and the state machine is
+ * only woken up once to process them. Events with a delay, and events that are routed to the
+ * parent state machine or to invoked services, are handled as in submitEvent().
+ *
+ * The events are processed in successive macrosteps, and reachedStableState() is emitted after
+ * the last of them has been processed.
+ *
+ * \sa submitEvent()
+ */
+void QScxmlStateMachine::submitEvents(const QVector<QScxmlEvent *> &events)
+{
+    Q_D(QScxmlStateMachine);
+
+    QVector<QScxmlEvent *> localEvents;
+    localEvents.reserve(events.size());
+
+    foreach (QScxmlEvent *event, events) {
+        if (!event)
+            continue;
+
+        const QScxmlEventPrivate *ed = QScxmlEventPrivate::get(event);
+        if (event->delay() > 0 || ed->originAtom == QScxmlInternal::ParentTargetAtom
+                || (ed->originAtom == QScxmlInternal::OtherAtom
+                    && ed->origin.startsWith(QStringLiteral("#_")))) {
+            // Posting the events we have collected so far keeps the order of submission intact.
+            d->postEvents(localEvents);
+            localEvents.clear();
+            submitEvent(event);
+        } else {
+            localEvents.append(event);
+        }
+    }
+
+    qscxmlTrace() << this << "submitting" << localEvents.size() << "events";
+    d->postEvents(localEvents);
+}
+
 /*!
  * Cancels a delayed event with the specified \a sendId.
  */
@@ -1164,12 +1782,274 @@ void QScxmlStateMachine::cancelDelayedEvent(const QString &sendId)
 {
     Q_D(QScxmlStateMachine);
 
-    int id = d->m_qStateMachine->eventIdForDelayedEvent(sendId);
+    qscxmlTrace() << this << "canceling event" << sendId;
+    d->m_qStateMachine->cancelDelayedScxmlEvent(sendId);
+}
+
+/*!
+ * Returns \c true if the state machine is processed manually, \c false if it processes its events
+ * in the event loop.
+ *
+ * \sa setManualProcessing(), processEvents()
+ */
+bool QScxmlStateMachine::isManualProcessing() const
+{
+    Q_D(const QScxmlStateMachine);
+    return d->m_manualProcessing;
+}
+
+/*!
+ * Sets whether the state machine is processed manually to \a manualProcessing. This can only be
+ * changed while the state machine is not running.
+ *
+ * A manually processed state machine does not need an event loop. start() enters the initial
+ * configuration right away, in the calling thread. Submitted events are only queued, and are
+ * processed when processEvents() is called. Delayed events become due according to clock().
+ *
+ * The state machine has to be started, stopped, and processed in the thread it lives in.
+ * Services invoked by the state machine are not affected, and still run in the event loop.
+ *
+ * \sa processEvents(), setClock()
+ */
+void QScxmlStateMachine::setManualProcessing(bool manualProcessing)
+{
+    Q_D(QScxmlStateMachine);
+
+    if (d->m_manualProcessing == manualProcessing)
+        return;
+
+    if (isRunning()) {
+        qCWarning(qscxmlLog) << this << "cannot change the processing mode while running";
+        return;
+    }
+
+    d->m_manualProcessing = manualProcessing;
+}
+
+/*!
+ * Returns the clock used to schedule delayed events of a manually processed state machine, or
+ * \c nullptr if the monotonic system clock is used.
+ *
+ * \sa setClock()
+ */
+QScxmlClock *QScxmlStateMachine::clock() const
+{
+    Q_D(const QScxmlStateMachine);
+    return d->m_clock;
+}
+
+/*!
+ * Sets the clock used to schedule delayed events of a manually processed state machine to
+ * \a clock. The state machine does not take ownership of the clock. Passing \c nullptr makes
+ * the state machine use the monotonic system clock again.
+ *
+ * \sa clock(), setManualProcessing()
+ */
+void QScxmlStateMachine::setClock(QScxmlClock *clock)
+{
+    Q_D(QScxmlStateMachine);
+    d->m_clock = clock;
+}
+
+/*!
+ * Returns the tracer that records the steps of this state machine, or \c nullptr if none is
+ * installed.
+ *
+ * \sa setTracer()
+ */
+QScxmlTracer *QScxmlStateMachine::tracer() const
+{
+    Q_D(const QScxmlStateMachine);
+    return d->m_tracer;
+}
+
+/*!
+ * Installs \a tracer to record the steps of this state machine. The state machine does not take
+ * ownership of the tracer. Passing \c nullptr removes the current tracer.
+ *
+ * The tracer has to be installed from the thread of the state machine, preferably before it is
+ * started.
+ *
+ * \sa tracer(), QScxmlTracer
+ */
+void QScxmlStateMachine::setTracer(QScxmlTracer *tracer)
+{
+    Q_D(QScxmlStateMachine);
+    d->m_tracer = tracer;
+    if (tracer)
+        tracer->attach(this);
+}
+
+/*!
+ * Returns which string payloads of events are parsed as JSON.
+ *
+ * \sa setJsonDataParsing()
+ */
+QScxmlStateMachine::JsonDataParsing QScxmlStateMachine::jsonDataParsing() const
+{
+    Q_D(const QScxmlStateMachine);
+    return d->m_jsonDataParsing;
+}
+
+/*!
+ * Sets which string payloads of events are parsed as JSON to \a parsing.
+ *
+ * Detecting JSON in a string payload costs a conversion to UTF-8 and a parse attempt. A state
+ * machine whose events carry large text payloads that are never meant as JSON can avoid this
+ * with ParseNoJsonData or ParseMarkedJsonData. Structured data is best submitted as a
+ * QVariantMap or a QJsonObject, which is converted without any parsing.
+ *
+ * \sa jsonDataParsing(), QScxmlEvent::setJsonData()
+ */
+void QScxmlStateMachine::setJsonDataParsing(JsonDataParsing parsing)
+{
+    Q_D(QScxmlStateMachine);
+    d->m_jsonDataParsing = parsing;
+}
+
+/*!
+ * Processes the events of a manually processed state machine in the calling thread, and returns
+ * the number of external events that were processed.
+ *
+ * Delayed events that are due according to clock() are submitted first. Then the queued external
+ * events are processed one after the other, each in its own macrostep, until the queue is empty or
+ * \a maxMacrosteps events have been processed. A negative value of \a maxMacrosteps means no
+ * limit.
+ *
+ * Events that are submitted while processing are queued, and processed in the same call if the
+ * limit allows it.
+ *
+ * \sa setManualProcessing()
+ */
+int QScxmlStateMachine::processEvents(int maxMacrosteps)
+{
+    Q_D(QScxmlStateMachine);
+
+    if (!d->m_manualProcessing) {
+        qCWarning(qscxmlLog) << this << "processes its events in the event loop";
+        return 0;
+    }
+
+    return d->m_qStateMachine->processManualEvents(d->currentTime(), maxMacrosteps);
+}
+
+void QScxmlInternal::WrappedQStateMachine::startManually()
+{
+    Q_D(WrappedQStateMachine);
+
+    if ((childMode() == QState::ExclusiveStates) && (initialState() == 0)) {
+        qWarning("QStateMachine::start: No initial state set for machine. Refusing to start.");
+        return;
+    }
+
+    switch (d->state) {
+    case QStateMachinePrivate::NotRunning:
+        // This is what QStateMachine::start() does, minus the round trip through the event loop.
+        d->state = QStateMachinePrivate::Starting;
+        d->_q_start();
+        break;
+    case QStateMachinePrivate::Starting:
+        break;
+    case QStateMachinePrivate::Running:
+        qWarning("QStateMachine::start(): already running");
+        break;
+    }
+}
 
-    qCDebug(qscxmlLog) << this << "canceling event" << sendId << "with id" << id;
+void QScxmlInternal::WrappedQStateMachine::stopManually()
+{
+    Q_D(WrappedQStateMachine);
 
-    if (id != -1)
-        d->m_qStateMachine->cancelDelayedEvent(id);
+    switch (d->state) {
+    case QStateMachinePrivate::NotRunning:
+        break;
+    case QStateMachinePrivate::Starting:
+        d->stop = true;
+        break;
+    case QStateMachinePrivate::Running:
+        // If this is called during a macrostep, processEvents() returns right away and the running
+        // macrostep stops the state machine instead.
+        d->stop = true;
+        d->processEvents(QStateMachinePrivate::DirectProcessing);
+        break;
+    }
+}
+
+// Stops the state machine without a round trip through the event loop. That is not possible while
+// it is starting, processing events, or has a processing run scheduled; false is returned then.
+bool QScxmlInternal::WrappedQStateMachine::stopImmediately()
+{
+    Q_D(WrappedQStateMachine);
+
+    if (d->state == QStateMachinePrivate::NotRunning)
+        return true;
+    if (d->state != QStateMachinePrivate::Running || d->processing || d->processingScheduled)
+        return false;
+
+    d->stop = true;
+    d->processEvents(QStateMachinePrivate::DirectProcessing);
+    return d->state == QStateMachinePrivate::NotRunning;
+}
+
+void QScxmlInternal::WrappedQStateMachine::postManualEvent(QScxmlEvent *event,
+                                                           EventPriority priority)
+{
+    Q_D(WrappedQStateMachine);
+
+    if (priority == NormalPriority) {
+        d->m_manualEvents.enqueue(event);
+    } else if (d->state == QStateMachinePrivate::NotRunning) {
+        queueEvent(event, priority);
+    } else {
+        // Internal events are processed as part of the current or the next macrostep. Posting
+        // them must not schedule any processing in the event loop.
+        d->postInternalEvent(event);
+    }
+}
+
+
+int QScxmlInternal::WrappedQStateMachine::processManualEvents(qint64 currentTime, int maxMacrosteps)
+{
+    Q_D(WrappedQStateMachine);
+
+    if (d->state != QStateMachinePrivate::Running || d->processing)
+        return 0;
+
+    // Events submitted from other threads are only picked up by an event loop or a macrostep,
+    // and the caller might run neither.
+    stateMachinePrivate()->processForeignEvents();
+
+    // Expired delays are handled like the timer events of automatically processed machines.
+    routeDueDelayedEvents(currentTime);
+
+    // Internal events submitted from the outside are processed before any external event.
+    if (!d->isInternalEventQueueEmpty())
+        d->processEvents(QStateMachinePrivate::DirectProcessing);
+
+    int macrosteps = 0;
+    while (d->state == QStateMachinePrivate::Running && !d->m_manualEvents.isEmpty()
+           && (maxMacrosteps < 0 || macrosteps < maxMacrosteps)) {
+        d->postExternalEvent(d->m_manualEvents.dequeue());
+        d->processEvents(QStateMachinePrivate::DirectProcessing);
+        ++macrosteps;
+    }
+
+    return macrosteps;
+}
+
+void QScxmlInternal::WrappedQStateMachine::discardPendingEvents()
+{
+    Q_D(WrappedQStateMachine);
+
+    if (d->m_queuedEvents) {
+        foreach (const WrappedQStateMachinePrivate::QueuedEvent &e, *d->m_queuedEvents)
+            delete e.event;
+        delete d->m_queuedEvents;
+        d->m_queuedEvents = Q_NULLPTR;
+    }
+    qDeleteAll(d->m_manualEvents);
+    d->m_manualEvents.clear();
+    cancelAllDelayedScxmlEvents();
 }
 
 void QScxmlInternal::WrappedQStateMachine::queueEvent(QScxmlEvent *event, EventPriority priority)
@@ -1185,27 +2065,161 @@ void QScxmlInternal::WrappedQStateMachine::submitQueuedEvents()
 {
     Q_D(WrappedQStateMachine);
 
-    qCDebug(qscxmlLog) << d->m_stateMachine << ": submitting queued events";
+    qscxmlTrace() << d->m_stateMachine << ": submitting queued events";
 
     if (d->m_queuedEvents) {
-        foreach (const WrappedQStateMachinePrivate::QueuedEvent &e, *d->m_queuedEvents)
-            postEvent(e.event, e.priority);
+        const bool manual = d->stateMachinePrivate()->m_manualProcessing;
+        foreach (const WrappedQStateMachinePrivate::QueuedEvent &e, *d->m_queuedEvents) {
+            if (manual)
+                postManualEvent(static_cast<QScxmlEvent *>(e.event), e.priority);
+            else
+                postEvent(e.event, e.priority);
+        }
         delete d->m_queuedEvents;
         d->m_queuedEvents = Q_NULLPTR;
     }
 }
 
-int QScxmlInternal::WrappedQStateMachine::eventIdForDelayedEvent(const QString &sendId)
+void QScxmlInternal::WrappedQStateMachine::postEvents(const QVector<QScxmlEvent *> &events)
+{
+    Q_D(WrappedQStateMachine);
+
+    bool hasInternalEvents = false;
+    {
+        QMutexLocker locker(&d->externalEventMutex);
+        foreach (QScxmlEvent *event, events) {
+            if (event->eventType() == QScxmlEvent::ExternalEvent)
+                d->externalEventQueue.append(event);
+            else
+                hasInternalEvents = true;
+        }
+    }
+
+    if (hasInternalEvents) {
+        QMutexLocker locker(&d->internalEventMutex);
+        foreach (QScxmlEvent *event, events) {
+            if (event->eventType() != QScxmlEvent::ExternalEvent)
+                d->internalEventQueue.append(event);
+        }
+    }
+
+    d->processEvents(QStateMachinePrivate::QueuedProcessing);
+}
+
+void QScxmlInternal::WrappedQStateMachine::postDelayedScxmlEvent(QScxmlEvent *event,
+                                                                 qint64 dueTime)
+{
+    Q_D(WrappedQStateMachine);
+
+    bool isEarliest;
+    {
+        QMutexLocker locker(&d->m_delayedEventsMutex);
+        const WrappedQStateMachinePrivate::DelayedEventKey key(dueTime,
+                                                               d->m_delayedEventCounter++);
+        d->m_delayedEvents.insert(key, event);
+        if (!event->sendId().isEmpty())
+            d->m_delayedEventKeys.insert(event->sendId(), key);
+        isEarliest = d->m_delayedEvents.firstKey() == key;
+    }
+
+    qscxmlTrace() << stateMachine() << ": delayed event" << event->name() << "is due at"
+                  << dueTime;
+
+    // Manually processed state machines check for due events in processEvents().
+    if (!isEarliest || d->stateMachinePrivate()->m_manualProcessing)
+        return;
+
+    if (QThread::currentThread() == thread())
+        updateDelayedEventTimer();
+    else
+        QMetaObject::invokeMethod(this, "updateDelayedEventTimer", Qt::QueuedConnection);
+}
+
+bool QScxmlInternal::WrappedQStateMachine::cancelDelayedScxmlEvent(const QString &sendId)
 {
     Q_D(WrappedQStateMachine);
-    return d->eventIdForDelayedEvent(sendId);
+
+    // If this was the earliest event, the timer will fire for nothing and be rearmed then.
+    QMutexLocker locker(&d->m_delayedEventsMutex);
+    const QList<WrappedQStateMachinePrivate::DelayedEventKey> keys
+            = d->m_delayedEventKeys.values(sendId);
+    d->m_delayedEventKeys.remove(sendId);
+    foreach (const WrappedQStateMachinePrivate::DelayedEventKey &key, keys)
+        delete d->m_delayedEvents.take(key);
+    return !keys.isEmpty();
+}
+
+void QScxmlInternal::WrappedQStateMachine::cancelAllDelayedScxmlEvents()
+{
+    Q_D(WrappedQStateMachine);
+
+    QMutexLocker locker(&d->m_delayedEventsMutex);
+    qDeleteAll(d->m_delayedEvents);
+    d->m_delayedEvents.clear();
+    d->m_delayedEventKeys.clear();
+}
+
+void QScxmlInternal::WrappedQStateMachine::routeDueDelayedEvents(qint64 currentTime)
+{
+    Q_D(WrappedQStateMachine);
+
+    QVector<QScxmlEvent *> dueEvents;
+    {
+        QMutexLocker locker(&d->m_delayedEventsMutex);
+        auto it = d->m_delayedEvents.begin();
+        while (it != d->m_delayedEvents.end() && it.key().first <= currentTime) {
+            QScxmlEvent *event = it.value();
+            if (!event->sendId().isEmpty())
+                d->m_delayedEventKeys.remove(event->sendId(), it.key());
+            dueEvents.append(event);
+            it = d->m_delayedEvents.erase(it);
+        }
+    }
+
+    // Routing can execute arbitrary code, which may submit or cancel delayed events again.
+    foreach (QScxmlEvent *event, dueEvents)
+        d->stateMachinePrivate()->routeEvent(event);
+}
+
+void QScxmlInternal::WrappedQStateMachine::updateDelayedEventTimer()
+{
+    Q_D(WrappedQStateMachine);
+
+    bool hasDelayedEvents;
+    qint64 dueTime = 0;
+    {
+        QMutexLocker locker(&d->m_delayedEventsMutex);
+        hasDelayedEvents = !d->m_delayedEvents.isEmpty();
+        if (hasDelayedEvents)
+            dueTime = d->m_delayedEvents.firstKey().first;
+    }
+
+    if (d->m_delayedEventScheduler) {
+        if (hasDelayedEvents && dueTime == d->m_delayedEventTimerDueTime)
+            return;
+        d->m_delayedEventScheduler->unschedule(this);
+        d->m_delayedEventScheduler = Q_NULLPTR;
+    }
+
+    if (!hasDelayedEvents)
+        return;
+
+    DelayedEventScheduler *scheduler = DelayedEventScheduler::forCurrentThread();
+    if (!scheduler) // shutting down
+        return;
+    const qint64 interval = qMax(dueTime - d->stateMachinePrivate()->currentTime(), qint64(0));
+    scheduler->schedule(this, interval);
+    d->m_delayedEventScheduler = scheduler;
+    d->m_delayedEventTimerDueTime = dueTime;
 }
 
 void QScxmlInternal::WrappedQStateMachine::removeAndDestroyService(QScxmlInvokableService *service)
 {
     Q_D(WrappedQStateMachine);
-    qCDebug(qscxmlLog) << stateMachine() << "canceling service" << service->id();
+    qscxmlTrace() << stateMachine() << "canceling service" << service->id();
     if (d->stateMachinePrivate()->removeService(service)) {
+        if (auto scxml = dynamic_cast<QScxmlInvokableScxml *>(service))
+            scxml->recycleStateMachine();
         delete service;
     }
 }
@@ -1234,12 +2248,8 @@ bool QScxmlStateMachine::isDispatchableTarget(const QString &target) const
         return true; // that's the current state machine
 
     if (target.startsWith(QStringLiteral("#_"))) {
-        QStringRef targetId = target.midRef(2);
-        foreach (QScxmlInvokableService *service, d->m_invokedServices) {
-            if (service->id() == targetId) {
-                return true;
-            }
-        }
+        if (d->m_servicesById.contains(target.mid(2)))
+            return true;
     }
 
     return false;
@@ -1295,9 +2305,12 @@ void QScxmlStateMachine::start()
 
     // Failure to initialize doesn't prevent start(). See w3c-ecma/test487 in the scion test suite.
     if (!isInitialized() && !init())
-        qCDebug(qscxmlLog) << this << "cannot be initialized on start(). Starting anyway ...";
+        qscxmlTrace() << this << "cannot be initialized on start(). Starting anyway ...";
 
-    d->m_qStateMachine->start();
+    if (d->m_manualProcessing)
+        d->m_qStateMachine->startManually();
+    else
+        d->m_qStateMachine->start();
 }
 
 /*!
@@ -1309,7 +2322,10 @@ void QScxmlStateMachine::start()
 void QScxmlStateMachine::stop()
 {
     Q_D(QScxmlStateMachine);
-    d->m_qStateMachine->stop();
+    if (d->m_manualProcessing)
+        d->m_qStateMachine->stopManually();
+    else
+        d->m_qStateMachine->stop();
 }
 
 /*!
@@ -68,12 +68,21 @@ public:
     virtual bool handle(QScxmlEvent *event, QScxmlStateMachine *stateMachine) = 0;
 };
 
+class Q_SCXML_EXPORT QScxmlClock
+{
+public:
+    virtual ~QScxmlClock();
+    virtual qint64 currentTime() const = 0;
+};
+
+class QScxmlTracer;
+
 class QScxmlStateMachinePrivate;
 class Q_SCXML_EXPORT QScxmlStateMachine: public QObject
 {
     Q_DECLARE_PRIVATE(QScxmlStateMachine)
     Q_OBJECT
-    Q_ENUMS(BindingMethod)
+    Q_ENUMS(BindingMethod JsonDataParsing)
     Q_PROPERTY(bool running READ isRunning WRITE setRunning NOTIFY runningChanged)
     Q_PROPERTY(bool initialized READ isInitialized NOTIFY initializedChanged)
     Q_PROPERTY(QScxmlDataModel *dataModel READ dataModel WRITE setDataModel NOTIFY dataModelChanged)
@@ -91,6 +100,12 @@ public:
         LateBinding
     };
 
+    enum JsonDataParsing {
+        ParseAllJsonData,
+        ParseMarkedJsonData,
+        ParseNoJsonData
+    };
+
     static QScxmlStateMachine *fromFile(const QString &fileName);
     static QScxmlStateMachine *fromData(QIODevice *data, const QString &fileName = QString());
     QVector<QScxmlError> parseErrors() const;
@@ -128,8 +143,19 @@ public:
     Q_INVOKABLE void submitEvent(QScxmlEvent *event);
     Q_INVOKABLE void submitEvent(const QString &eventName);
     Q_INVOKABLE void submitEvent(const QString &eventName, const QVariant &data);
+    void submitEvents(const QVector<QScxmlEvent *> &events);
     void cancelDelayedEvent(const QString &sendId);
 
+    bool isManualProcessing() const;
+    void setManualProcessing(bool manualProcessing);
+    QScxmlClock *clock() const;
+    void setClock(QScxmlClock *clock);
+    QScxmlTracer *tracer() const;
+    void setTracer(QScxmlTracer *tracer);
+    JsonDataParsing jsonDataParsing() const;
+    void setJsonDataParsing(JsonDataParsing parsing);
+    int processEvents(int maxMacrosteps = -1);
+
     bool isDispatchableTarget(const QString &target) const;
 
 Q_SIGNALS:
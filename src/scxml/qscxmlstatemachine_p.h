@@ -53,13 +53,111 @@
 
 #include <QtScxml/private/qscxmlexecutablecontent_p.h>
 #include <QtScxml/qscxmlstatemachine.h>
-
+#include <QtScxml/qscxmltracer.h>
+
+#include <QAtomicPointer>
+#include <QBitArray>
+#include <QElapsedTimer>
+#include <QEvent>
+#include <QMultiHash>
+#include <QMutex>
 #include <QStateMachine>
 #include <QtCore/private/qstatemachine_p.h>
 
 QT_BEGIN_NAMESPACE
 
 namespace QScxmlInternal {
+// Flat view of the state hierarchy of one state machine. States are indexed densely in document
+// order (depth-first, pre-order), which is also the order QStateMachine uses for its entry sets.
+//
+// This is only an index next to QStateMachine: transition selection and the entry and exit sets
+// are still computed by QStateMachine, and the table is kept in sync with it.
+class StateTable
+{
+public:
+    StateTable();
+
+    void build(QState *root);
+    bool isBuilt() const
+    { return m_built; }
+
+    int stateCount() const
+    { return m_states.size(); }
+    QAbstractState *state(int stateIndex) const
+    { return m_states.at(stateIndex); }
+    int parentIndex(int stateIndex) const
+    { return m_parents.at(stateIndex); }
+    bool isLeaf(int stateIndex) const
+    { return m_childCounts.at(stateIndex) == 0; }
+
+    int indexOf(const QAbstractState *state) const
+    { return m_indexByState.value(state, -1); }
+    int indexOf(const QString &scxmlName) const
+    { return m_indexByName.value(scxmlName, -1); }
+
+    int eventDescriptorCount() const
+    { return m_eventDescriptorCount; }
+    void matchEvent(const QString &eventName, QBitArray *matchedDescriptors) const;
+
+private:
+    void addChildStates(QObject *parent, int parentIndex);
+    void compileTransitions(QState *state);
+    int addEventDescriptor(const QString &descriptor);
+
+    // Event descriptors, split at the dots. Each node is one segment of a descriptor; the
+    // descriptors ending in a node match all events whose name starts with the node's path.
+    struct EventTrieNode
+    {
+        QHash<QString, int> children;
+        QVector<int> descriptors;
+    };
+    QVector<EventTrieNode> m_eventTrie;
+    QHash<QString, int> m_eventDescriptorIds;
+    int m_eventDescriptorCount;
+
+    bool m_built;
+    QVector<QAbstractState *> m_states;
+    QVector<int> m_parents;
+    QVector<int> m_childCounts;
+    QHash<const QAbstractState *, int> m_indexByState;
+    QHash<QString, int> m_indexByName;
+};
+
+// Events that were submitted from other threads than the one of the state machine. Any number of
+// threads can push events without taking a lock; only the thread of the state machine takes them out,
+// all at once. The producer that finds the queue empty is told so, and has to wake the consumer up.
+class ForeignEventQueue
+{
+    Q_DISABLE_COPY(ForeignEventQueue)
+
+public:
+    struct Entry
+    {
+        QScxmlEvent *event;
+        bool submit; // not routed yet
+    };
+
+    ForeignEventQueue();
+    ~ForeignEventQueue();
+
+    bool isEmpty() const
+    { return m_head.loadAcquire() == Q_NULLPTR; }
+    bool push(QScxmlEvent *event, bool submit);
+    QVector<Entry> takeAll();
+
+    static QEvent::Type wakeUpEventType();
+
+private:
+    struct Node
+    {
+        Node *next;
+        Entry entry;
+    };
+
+    QAtomicPointer<Node> m_head; // most recently pushed first
+};
+
+class DelayedEventScheduler;
 class WrappedQStateMachinePrivate;
 class WrappedQStateMachine: public QStateMachine
 {
@@ -69,12 +167,26 @@ class WrappedQStateMachine: public QStateMachine
 public:
     WrappedQStateMachine(QScxmlStateMachine *parent);
     WrappedQStateMachine(WrappedQStateMachinePrivate &dd, QScxmlStateMachine *parent);
+    ~WrappedQStateMachine();
 
     QScxmlStateMachine *stateMachine() const;
 
     void queueEvent(QScxmlEvent *event, QStateMachine::EventPriority priority);
     void submitQueuedEvents();
-    int eventIdForDelayedEvent(const QString &sendId);
+    void postEvents(const QVector<QScxmlEvent *> &events);
+
+    void postDelayedScxmlEvent(QScxmlEvent *event, qint64 dueTime);
+    bool cancelDelayedScxmlEvent(const QString &sendId);
+    void cancelAllDelayedScxmlEvents();
+    void routeDueDelayedEvents(qint64 currentTime);
+    Q_INVOKABLE void updateDelayedEventTimer();
+
+    void startManually();
+    void stopManually();
+    bool stopImmediately();
+    void postManualEvent(QScxmlEvent *event, QStateMachine::EventPriority priority);
+    int processManualEvents(qint64 currentTime, int maxMacrosteps);
+    void discardPendingEvents();
 
     Q_INVOKABLE void removeAndDestroyService(QScxmlInvokableService *service);
 
@@ -85,7 +197,10 @@ protected:
     bool event(QEvent *e) Q_DECL_OVERRIDE;
 
 private:
+    friend class DelayedEventScheduler;
+
     QScxmlStateMachinePrivate *stateMachinePrivate();
+    void delayedEventTimeout();
 };
 } // Internal namespace
 
@@ -117,6 +232,23 @@ public:
     void setQStateMachine(QScxmlInternal::WrappedQStateMachine *stateMachine);
 
     QAbstractState *stateByScxmlName(const QString &scxmlName);
+    const QScxmlInternal::StateTable &stateTable() const;
+
+    bool isActive(int stateIndex) const
+    { return stateIndex >= 0 && stateIndex < m_activeStates.size() && m_activeStates.testBit(stateIndex); }
+    void setActive(const QAbstractState *state, bool active);
+    void resetActiveStates()
+    { m_activeStates.fill(false); }
+
+    bool isEventDescriptorMatched(int descriptor) const
+    {
+        return descriptor >= 0 && descriptor < m_matchedEventDescriptors.size()
+                && m_matchedEventDescriptors.testBit(descriptor);
+    }
+    void matchEventDescriptors(const QString &eventName)
+    { stateTable().matchEvent(eventName, &m_matchedEventDescriptors); }
+    void clearMatchedEventDescriptors()
+    { m_matchedEventDescriptors.fill(false); }
 
     ParserData *parserData();
 
@@ -126,16 +258,45 @@ public:
     const QVector<QScxmlInvokableService *> &invokedServices() const
     { return m_invokedServices; }
 
+    const QVector<QScxmlInvokableService *> &autoforwardServices() const
+    { return m_autoforwardServices; }
+
+    QList<QScxmlInvokableService *> servicesById(const QString &invokeId) const
+    { return m_servicesById.values(invokeId); }
+
     void addService(QScxmlInvokableService *service);
+    void registerServiceId(QScxmlInvokableService *service);
 
     bool removeService(QScxmlInvokableService *service);
 
     bool executeInitialSetup();
+    bool resetForReuse();
 
     void routeEvent(QScxmlEvent *event);
+    bool postToParent(QScxmlEvent *event);
+    void detachFromParent();
     void postEvent(QScxmlEvent *event);
+    void postEvents(const QVector<QScxmlEvent *> &events);
+    void postForeignEvent(QScxmlEvent *event, bool submit);
+    void processForeignEvents();
     void submitError(const QString &type, const QString &msg, const QString &sendid = QString());
 
+    qint64 currentTime() const
+    { return m_manualProcessing && m_clock ? m_clock->currentTime() : m_systemClock.elapsed(); }
+
+    void trace(QScxmlTracer::RecordType type, qint32 id = -1, qint32 detail = -1)
+    {
+        if (m_tracer) {
+            const QScxmlTracer::Record record = { m_tracer->elapsed(), type, id, detail };
+            m_tracer->record(record);
+        }
+    }
+    void traceEvent(QScxmlTracer::RecordType type, const QScxmlEvent *event)
+    {
+        if (m_tracer)
+            trace(type, m_tracer->nameId(event->name()), event->eventType());
+    }
+
 public: // types & data fields:
     QString m_sessionId;
     bool m_isInvoked;
@@ -150,9 +311,21 @@ public: // types & data fields:
     QScxmlEventFilter *m_eventFilter;
     QVector<QScxmlState*> m_statesToInvoke;
     QScxmlStateMachine *m_parentStateMachine;
+    QMutex m_parentStateMachineMutex; // the child may run in another thread than its parent
+    QScxmlInternal::ForeignEventQueue m_foreignEvents;
+    bool m_manualProcessing;
+    QScxmlClock *m_clock;
+    QScxmlTracer *m_tracer;
+    QScxmlStateMachine::JsonDataParsing m_jsonDataParsing;
+    QElapsedTimer m_systemClock; // used when no clock is set
 
 private:
+    mutable QScxmlInternal::StateTable m_stateTable;
+    QBitArray m_activeStates; // indexed like m_stateTable, kept in sync with the configuration
+    QBitArray m_matchedEventDescriptors; // descriptors matching the event in m_event
     QVector<QScxmlInvokableService *> m_invokedServices;
+    QMultiHash<QString, QScxmlInvokableService *> m_servicesById; // started services, by invoke id
+    QVector<QScxmlInvokableService *> m_autoforwardServices;
     QScopedPointer<ParserData> m_parserData; // used when created by StateMachine::fromFile.
 };
 
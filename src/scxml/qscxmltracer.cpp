@@ -0,0 +1,338 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the QtScxml module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "qscxmltracer.h"
+#include "qscxmlglobals_p.h"
+#include "qscxmlstatemachine_p.h"
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHash>
+#include <QtEndian>
+
+QT_BEGIN_NAMESPACE
+
+/*!
+ * \class QScxmlTracer
+ * \brief The QScxmlTracer class receives structured records of what a state machine does.
+ * \since 5.7
+ * \inmodule QtScxml
+ *
+ * A tracer is installed on a single state machine with QScxmlStateMachine::setTracer(). The
+ * state machine then calls record() at each of the points listed in RecordType. The records only
+ * carry a timestamp and two integers, so that tracing a busy state machine stays cheap. Strings,
+ * like event names, are replaced by IDs from nameId(); subclasses are told about new names
+ * through nameAdded().
+ *
+ * The debug output of the interpreter in the \c qt.scxml.statemachine logging category is too
+ * expensive to leave enabled under load, and can be compiled out by configuring the module with
+ * \c{CONFIG += scxml_no_trace}. Tracers keep working in such a build; when no tracer is
+ * installed, each point costs a single pointer check.
+ *
+ * record() is called in the thread of the state machine, in the middle of processing events. It
+ * must not call back into the state machine.
+ *
+ * \sa QScxmlFileTracer
+ */
+
+/*!
+ * \enum QScxmlTracer::RecordType
+ *
+ * This enum specifies what a record describes, and what its \c id and \c detail members hold.
+ * State IDs are the indexes of the states in document order, starting at \c 0 for the first
+ * child of the root. Evaluator IDs are the ones in QScxmlTableData.
+ *
+ * \value MacrostepBegin
+ *        The state machine starts processing its queued events. \c id and \c detail are \c -1.
+ * \value MacrostepEnd
+ *        The state machine has reached a stable state. \c id and \c detail are \c -1.
+ * \value EventEnqueued
+ *        An event was added to the internal or external queue. \c id is the name ID of the event,
+ *        \c detail its QScxmlEvent::EventType.
+ * \value EventDequeued
+ *        An event was taken from the queue to select transitions for. \c id is the name ID of the
+ *        event, \c detail its QScxmlEvent::EventType.
+ * \value GuardBegin
+ *        The condition of a transition is about to be evaluated. \c id is the evaluator ID of
+ *        the condition, \c detail is \c -1.
+ * \value GuardEnd
+ *        The condition of a transition was evaluated. \c id is the evaluator ID of the
+ *        condition, \c detail is \c 1 if it was met, and \c 0 otherwise.
+ * \value TransitionTaken
+ *        A transition is taken. \c id is the ID of its source state, \c detail the index of the
+ *        transition among the transitions of that state.
+ * \value StateExited
+ *        A state was exited. \c id is the ID of the state.
+ * \value StateEntered
+ *        A state was entered. \c id is the ID of the state.
+ * \value InstructionExecuted
+ *        An instruction of executable content is about to be executed. \c id is its offset in
+ *        QScxmlTableData::instructions(), \c detail the ID of the evaluator it runs, or \c -1.
+ * \value MicrostepBegin
+ *        The state machine starts taking the enabled transitions for an event. \c id is the name
+ *        ID of the event, \c detail its QScxmlEvent::EventType.
+ * \value MicrostepEnd
+ *        The state machine has taken the enabled transitions for an event. \c id and \c detail
+ *        are as for MicrostepBegin.
+ */
+
+/*!
+ * \class QScxmlTracer::Record
+ * \brief The Record struct describes one step of a state machine.
+ * \since 5.7
+ * \inmodule QtScxml
+ *
+ * \c timestamp is the value of elapsed() when the step was taken. The meaning of \c id and
+ * \c detail depends on \c type.
+ */
+
+class QScxmlTracerPrivate
+{
+public:
+    QElapsedTimer timer;
+    QHash<QString, qint32> nameIds;
+};
+
+/*!
+ * Creates a tracer. Its timestamps count from this moment.
+ */
+QScxmlTracer::QScxmlTracer()
+    : d(new QScxmlTracerPrivate)
+{
+    d->timer.start();
+}
+
+/*!
+ * Destroys the tracer. It has to be removed from the state machine it is installed on first.
+ */
+QScxmlTracer::~QScxmlTracer()
+{
+    delete d;
+}
+
+/*!
+ * Returns the number of nanoseconds since the tracer was created.
+ */
+qint64 QScxmlTracer::elapsed() const
+{
+    return d->timer.nsecsElapsed();
+}
+
+/*!
+ * Returns the ID of \a name. The IDs are assigned in ascending order, starting at \c 0, when a
+ * name is seen for the first time; nameAdded() is called then.
+ */
+qint32 QScxmlTracer::nameId(const QString &name)
+{
+    QHash<QString, qint32>::const_iterator it = d->nameIds.constFind(name);
+    if (it != d->nameIds.constEnd())
+        return *it;
+
+    const qint32 id = d->nameIds.size();
+    d->nameIds.insert(name, id);
+    nameAdded(id, name);
+    return id;
+}
+
+/*!
+ * Called when the tracer is installed on \a stateMachine. The default implementation does
+ * nothing.
+ */
+void QScxmlTracer::attach(QScxmlStateMachine *stateMachine)
+{
+    Q_UNUSED(stateMachine);
+}
+
+/*!
+ * \fn QScxmlTracer::record(const Record &record)
+ *
+ * Called for each step of the state machine, as described by \a record.
+ */
+
+/*!
+ * Called when \a name is given the ID \a id by nameId(). The default implementation does
+ * nothing.
+ */
+void QScxmlTracer::nameAdded(qint32 id, const QString &name)
+{
+    Q_UNUSED(id);
+    Q_UNUSED(name);
+}
+
+/*!
+ * \class QScxmlFileTracer
+ * \brief The QScxmlFileTracer class writes the records of a state machine to a binary file.
+ * \since 5.7
+ * \inmodule QtScxml
+ *
+ * The file is meant to be post-processed offline, for example to find the guards that take the
+ * most time, or the states that are entered most often. It is written in chunks, and consists of
+ * the eight bytes \c QSCXMLTR, a 32-bit version number (currently \c 1), and a sequence of
+ * entries. All integers are little-endian. Each entry starts with a one-byte tag:
+ *
+ * \list
+ * \li \c S: the states of the state machine. A 32-bit count follows, and for each state, in the
+ *     order of their IDs, the 32-bit ID of its parent state (\c -1 for children of the root), and
+ *     its name as a 32-bit byte count followed by UTF-8.
+ * \li \c N: a name. The 32-bit name ID, followed by the name as a 32-bit byte count and UTF-8.
+ * \li \c R: a record. The 64-bit timestamp, the 8-bit RecordType, and the 32-bit \c id and
+ *     \c detail.
+ * \endlist
+ */
+
+class QScxmlFileTracerPrivate
+{
+public:
+    enum { BufferSize = 64 * 1024 };
+
+    template <typename T>
+    void append(T value)
+    {
+        value = qToLittleEndian(value);
+        buffer.append(reinterpret_cast<const char *>(&value), sizeof(T));
+    }
+
+    void appendString(const QString &string)
+    {
+        const QByteArray utf8 = string.toUtf8();
+        append<qint32>(utf8.size());
+        buffer.append(utf8);
+    }
+
+    QFile file;
+    QByteArray buffer;
+};
+
+/*!
+ * Creates a tracer that writes to the file \a fileName, replacing its contents.
+ *
+ * \sa isOpen()
+ */
+QScxmlFileTracer::QScxmlFileTracer(const QString &fileName)
+    : d(new QScxmlFileTracerPrivate)
+{
+    d->file.setFileName(fileName);
+    if (d->file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        d->buffer.reserve(QScxmlFileTracerPrivate::BufferSize);
+        d->buffer.append("QSCXMLTR", 8);
+        d->append<quint32>(1);
+    } else {
+        qCWarning(qscxmlLog) << "cannot open trace file" << fileName << ":" << d->file.errorString();
+    }
+}
+
+/*!
+ * Writes the remaining records and closes the file.
+ */
+QScxmlFileTracer::~QScxmlFileTracer()
+{
+    flush();
+    delete d;
+}
+
+/*!
+ * Returns \c true if the file could be opened for writing.
+ */
+bool QScxmlFileTracer::isOpen() const
+{
+    return d->file.isOpen();
+}
+
+/*!
+ * Writes the buffered records to the file.
+ */
+void QScxmlFileTracer::flush()
+{
+    if (d->buffer.isEmpty() || !d->file.isOpen())
+        return;
+    d->file.write(d->buffer);
+    d->file.flush();
+    // Unlike clear(), this keeps the reserved capacity for the next records.
+    d->buffer.resize(0);
+}
+
+/*!
+ * \reimp
+ * Writes the states of \a stateMachine, so that the state IDs in the records can be resolved.
+ */
+void QScxmlFileTracer::attach(QScxmlStateMachine *stateMachine)
+{
+    if (!d->file.isOpen())
+        return;
+
+    const QScxmlInternal::StateTable &table = QScxmlStateMachinePrivate::get(stateMachine)->stateTable();
+    d->buffer.append('S');
+    d->append<qint32>(table.stateCount());
+    for (int i = 0; i < table.stateCount(); ++i) {
+        d->append<qint32>(table.parentIndex(i));
+        d->appendString(table.state(i)->objectName());
+    }
+}
+
+/*!
+ * \reimp
+ */
+void QScxmlFileTracer::record(const Record &record)
+{
+    if (!d->file.isOpen())
+        return;
+
+    d->buffer.append('R');
+    d->append<qint64>(record.timestamp);
+    d->append<quint8>(quint8(record.type));
+    d->append<qint32>(record.id);
+    d->append<qint32>(record.detail);
+    if (d->buffer.size() >= QScxmlFileTracerPrivate::BufferSize)
+        flush();
+}
+
+/*!
+ * \reimp
+ */
+void QScxmlFileTracer::nameAdded(qint32 id, const QString &name)
+{
+    if (!d->file.isOpen())
+        return;
+
+    d->buffer.append('N');
+    d->append<qint32>(id);
+    d->appendString(name);
+}
+
+QT_END_NAMESPACE
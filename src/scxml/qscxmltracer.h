@@ -0,0 +1,118 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the QtScxml module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef QSCXMLTRACER_H
+#define QSCXMLTRACER_H
+
+#include <QtScxml/qscxmlglobals.h>
+
+#include <QString>
+
+QT_BEGIN_NAMESPACE
+
+class QScxmlStateMachine;
+
+class QScxmlTracerPrivate;
+class Q_SCXML_EXPORT QScxmlTracer
+{
+    Q_DISABLE_COPY(QScxmlTracer)
+
+public:
+    enum RecordType {
+        MacrostepBegin,
+        MacrostepEnd,
+        EventEnqueued,
+        EventDequeued,
+        GuardBegin,
+        GuardEnd,
+        TransitionTaken,
+        StateExited,
+        StateEntered,
+        InstructionExecuted,
+        MicrostepBegin,
+        MicrostepEnd
+    };
+
+    struct Record
+    {
+        qint64 timestamp;
+        RecordType type;
+        qint32 id;
+        qint32 detail;
+    };
+
+    QScxmlTracer();
+    virtual ~QScxmlTracer();
+
+    qint64 elapsed() const;
+    qint32 nameId(const QString &name);
+
+    virtual void attach(QScxmlStateMachine *stateMachine);
+    virtual void record(const Record &record) = 0;
+
+protected:
+    virtual void nameAdded(qint32 id, const QString &name);
+
+private:
+    QScxmlTracerPrivate *d;
+};
+
+class QScxmlFileTracerPrivate;
+class Q_SCXML_EXPORT QScxmlFileTracer: public QScxmlTracer
+{
+public:
+    explicit QScxmlFileTracer(const QString &fileName);
+    ~QScxmlFileTracer();
+
+    bool isOpen() const;
+    void flush();
+
+    void attach(QScxmlStateMachine *stateMachine) Q_DECL_OVERRIDE;
+    void record(const Record &record) Q_DECL_OVERRIDE;
+
+protected:
+    void nameAdded(qint32 id, const QString &name) Q_DECL_OVERRIDE;
+
+private:
+    QScxmlFileTracerPrivate *d;
+};
+
+QT_END_NAMESPACE
+
+#endif // QSCXMLTRACER_H
@@ -9,6 +9,9 @@ QMAKE_DOCS = $$PWD/doc/qtscxml.qdocconf
 CONFIG  += $$MODULE_CONFIG
 DEFINES += QT_NO_CAST_FROM_ASCII QT_NO_CAST_TO_ASCII
 
+# Compiles the debug output of the interpreter out. A QScxmlTracer still works.
+scxml_no_trace: DEFINES += QSCXML_NO_TRACE
+
 HEADERS += \
     qscxmlparser.h \
     qscxmlparser_p.h \
@@ -31,7 +34,12 @@ HEADERS += \
     qscxmlcppdatamodel.h \
     qscxmlerror.h \
     qscxmlinvokableservice.h \
-    qscxmltabledata.h
+    qscxmltabledata.h \
+    qscxmlcompiledchart.h \
+    qscxmlcompiledchart_p.h \
+    qscxmlexecutor.h \
+    qscxmlexecutor_p.h \
+    qscxmltracer.h
 
 SOURCES += \
     qscxmlparser.cpp \
@@ -46,7 +54,10 @@ SOURCES += \
     qscxmlcppdatamodel.cpp \
     qscxmlerror.cpp \
     qscxmlinvokableservice.cpp \
-    qscxmltabledata.cpp
+    qscxmltabledata.cpp \
+    qscxmlcompiledchart.cpp \
+    qscxmlexecutor.cpp \
+    qscxmltracer.cpp
 
 FEATURES += ../../mkspecs/features/qscxmlc.prf
 features.files = $$FEATURES
@@ -31,11 +31,84 @@
 #include <QXmlStreamReader>
 #include <QtScxml/qscxmlparser.h>
 #include <QtScxml/qscxmlstatemachine.h>
+#include <QtScxml/qscxmlcompiledchart.h>
+#include <QtScxml/qscxmldatamodel.h>
+#include <QtScxml/qscxmlecmascriptdatamodel.h>
+#include <QtScxml/qscxmlexecutor.h>
+#include <QtScxml/qscxmlinvokableservice.h>
+#include <QtScxml/qscxmlqstates.h>
+#include <QtScxml/qscxmltracer.h>
+#include <QtScxml/private/qscxmlqstates_p.h>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 
 Q_DECLARE_METATYPE(QScxmlError);
 
 enum { SpyWaitTime = 8000 };
 
+class ManualClock: public QScxmlClock
+{
+public:
+    ManualClock() : time(0) {}
+    qint64 currentTime() const Q_DECL_OVERRIDE { return time; }
+
+    qint64 time;
+};
+
+class RecordingTracer: public QScxmlTracer
+{
+public:
+    void record(const Record &record) Q_DECL_OVERRIDE
+    { records.append(record); }
+
+    QVector<Record> recordsOfType(RecordType type) const
+    {
+        QVector<Record> result;
+        foreach (const Record &record, records) {
+            if (record.type == type)
+                result.append(record);
+        }
+        return result;
+    }
+
+    QVector<Record> records;
+};
+
+// Submits events to a state machine living in another thread.
+class EventProducer: public QThread
+{
+public:
+    EventProducer(QScxmlStateMachine *stateMachine, const QStringList &eventNames)
+        : m_stateMachine(stateMachine), m_eventNames(eventNames) {}
+
+    void run() Q_DECL_OVERRIDE
+    {
+        foreach (const QString &name, m_eventNames)
+            m_stateMachine->submitEvent(name);
+    }
+
+private:
+    QScxmlStateMachine *m_stateMachine;
+    QStringList m_eventNames;
+};
+
+// Records the thread of each invoked child while the child is still alive.
+class ChildThreadRecorder: public QObject
+{
+    Q_OBJECT
+public slots:
+    void childChanged(QScxmlStateMachine *child)
+    {
+        if (child)
+            threads.append(child->thread());
+    }
+
+public:
+    QList<QThread *> threads;
+};
+
 class tst_StateMachine: public QObject
 {
     Q_OBJECT
@@ -47,8 +120,34 @@ private Q_SLOTS:
     void activeStateNames();
     void connectToFinal();
     void eventOccurred();
+    void submitEvents();
+    void submitFromOtherThread();
+    void tracer();
+    void manualProcessing();
+    void manualProcessingDelayedEvents();
+    void delayedEventsOfManyMachines();
+    void compiledChart();
+    void instantiateBenchmark_data();
+    void instantiateBenchmark();
+    void instantiateMemory_data();
+    void instantiateMemory();
+    void invokeBenchmark();
+    void invokePool();
+    void invokePoolCanceled();
+    void invokeThreaded();
+    void executor();
+    void executorSharedThreads();
+    void routeToInvokedService();
 
     void doneDotStateEvent();
+    void nestedIfElse();
+    void profileEvaluators();
+    void eventDataPerEvent();
+    void jsonDataParsing_data();
+    void jsonDataParsing();
+    void assignments();
+    void foreachLargeArray();
+    void scriptsRunEveryTime();
 };
 
 void tst_StateMachine::stateNames_data()
@@ -69,6 +168,9 @@ void tst_StateMachine::stateNames_data()
     QTest::newRow("stateNamesNested-notCompressed") << QString(":/tst_statemachine/statenamesnested.scxml")
                                       << false
                                       << (QStringList() << QString("a") << QString("b") << QString("super_top"));
+    QTest::newRow("stateNamesWithTransitions-compressed") << QString(":/tst_statemachine/invoke.scxml")
+                                      << true
+                                      << (QStringList() << QString("idle") << QString("invoking"));
 
     QTest::newRow("ids1") << QString(":/tst_statemachine/ids1.scxml")
                           << false
@@ -161,6 +263,553 @@ void tst_StateMachine::eventOccurred()
     QCOMPARE(qvariant_cast<QScxmlEvent>(externalEventOccurredSpy.at(0).at(0)).name(), QLatin1String("externalEvent"));
 }
 
+void tst_StateMachine::submitEvents()
+{
+    QScopedPointer<QScxmlStateMachine> stateMachine(QScxmlStateMachine::fromFile(QString(":/tst_statemachine/submitevents.scxml")));
+    QVERIFY(!stateMachine.isNull());
+
+    qRegisterMetaType<QScxmlEvent>();
+    QSignalSpy stableStateSpy(stateMachine.data(), SIGNAL(reachedStableState()));
+    QSignalSpy eventOccurredSpy(stateMachine.data(), SIGNAL(eventOccurred(QScxmlEvent)));
+
+    stateMachine->start();
+    QVERIFY(stableStateSpy.wait(SpyWaitTime));
+    stableStateSpy.clear();
+
+    QVector<QScxmlEvent *> events;
+    foreach (const QString &name, QStringList() << "e1" << "e2" << "e3") {
+        QScxmlEvent *event = new QScxmlEvent;
+        event->setName(name);
+        events.append(event);
+    }
+    stateMachine->submitEvents(events);
+
+    QVERIFY(stableStateSpy.wait(SpyWaitTime));
+    QCOMPARE(stableStateSpy.count(), 1);
+    QCOMPARE(stateMachine->activeStateNames(), QStringList() << QLatin1String("s3"));
+
+    QCOMPARE(eventOccurredSpy.count(), 3);
+    QCOMPARE(qvariant_cast<QScxmlEvent>(eventOccurredSpy.at(0).at(0)).name(), QLatin1String("e1"));
+    QCOMPARE(qvariant_cast<QScxmlEvent>(eventOccurredSpy.at(1).at(0)).name(), QLatin1String("e2"));
+    QCOMPARE(qvariant_cast<QScxmlEvent>(eventOccurredSpy.at(2).at(0)).name(), QLatin1String("e3"));
+}
+
+void tst_StateMachine::submitFromOtherThread()
+{
+    QScopedPointer<QScxmlStateMachine> stateMachine(QScxmlStateMachine::fromFile(QString(":/tst_statemachine/submitevents.scxml")));
+    QVERIFY(!stateMachine.isNull());
+
+    qRegisterMetaType<QScxmlEvent>();
+    QSignalSpy stableStateSpy(stateMachine.data(), SIGNAL(reachedStableState()));
+    QSignalSpy eventOccurredSpy(stateMachine.data(), SIGNAL(eventOccurred(QScxmlEvent)));
+
+    stateMachine->start();
+    QVERIFY(stableStateSpy.wait(SpyWaitTime));
+
+    // The events arrive in the order they were submitted in.
+    QStringList eventNames;
+    for (int i = 0; i < 1000; ++i)
+        eventNames << QStringLiteral("tick");
+    eventNames << QStringLiteral("e1") << QStringLiteral("e2") << QStringLiteral("e3");
+    EventProducer producer(stateMachine.data(), eventNames);
+    producer.start();
+    QVERIFY(producer.wait(SpyWaitTime));
+
+    QTRY_COMPARE_WITH_TIMEOUT(eventOccurredSpy.count(), eventNames.size(), SpyWaitTime);
+    QCOMPARE(stateMachine->activeStateNames(), QStringList() << QLatin1String("s3"));
+    for (int i = 0; i < eventNames.size(); ++i)
+        QCOMPARE(qvariant_cast<QScxmlEvent>(eventOccurredSpy.at(i).at(0)).name(), eventNames.at(i));
+}
+
+void tst_StateMachine::tracer()
+{
+    QScopedPointer<QScxmlStateMachine> stateMachine(QScxmlStateMachine::fromFile(QString(":/tst_statemachine/submitevents.scxml")));
+    QVERIFY(!stateMachine.isNull());
+
+    RecordingTracer tracer;
+    stateMachine->setTracer(&tracer);
+    QCOMPARE(stateMachine->tracer(), &tracer);
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString traceFileName = dir.path() + QLatin1String("/trace.bin");
+    QScopedPointer<QScxmlFileTracer> fileTracer(new QScxmlFileTracer(traceFileName));
+    QVERIFY(fileTracer->isOpen());
+
+    QSignalSpy stableStateSpy(stateMachine.data(), SIGNAL(reachedStableState()));
+    stateMachine->start();
+    QVERIFY(stableStateSpy.wait(SpyWaitTime));
+    stateMachine->submitEvent("e1");
+    QVERIFY(stableStateSpy.wait(SpyWaitTime));
+
+    // The states are numbered in document order: s0 is 0, s1 is 1.
+    QVector<QScxmlTracer::Record> entered = tracer.recordsOfType(QScxmlTracer::StateEntered);
+    QCOMPARE(entered.size(), 2);
+    QCOMPARE(entered.at(0).id, 0);
+    QCOMPARE(entered.at(1).id, 1);
+    QVector<QScxmlTracer::Record> exited = tracer.recordsOfType(QScxmlTracer::StateExited);
+    QCOMPARE(exited.size(), 1);
+    QCOMPARE(exited.at(0).id, 0);
+    QVector<QScxmlTracer::Record> taken = tracer.recordsOfType(QScxmlTracer::TransitionTaken);
+    QCOMPARE(taken.size(), 1);
+    QCOMPARE(taken.at(0).id, 0);
+    QCOMPARE(taken.at(0).detail, 0);
+
+    const qint32 e1 = tracer.nameId(QStringLiteral("e1"));
+    QVector<QScxmlTracer::Record> enqueued = tracer.recordsOfType(QScxmlTracer::EventEnqueued);
+    QCOMPARE(enqueued.size(), 1);
+    QCOMPARE(enqueued.at(0).id, e1);
+    QVector<QScxmlTracer::Record> dequeued = tracer.recordsOfType(QScxmlTracer::EventDequeued);
+    QCOMPARE(dequeued.size(), 1);
+    QCOMPARE(dequeued.at(0).id, e1);
+    QVERIFY(dequeued.at(0).timestamp >= enqueued.at(0).timestamp);
+    QVERIFY(!tracer.recordsOfType(QScxmlTracer::MacrostepEnd).isEmpty());
+    QVector<QScxmlTracer::Record> microsteps = tracer.recordsOfType(QScxmlTracer::MicrostepBegin);
+    QVERIFY(!microsteps.isEmpty());
+    QCOMPARE(microsteps.last().id, e1);
+    QCOMPARE(tracer.recordsOfType(QScxmlTracer::MicrostepEnd).size(), microsteps.size());
+
+    // The file starts with a header and the table of states.
+    stateMachine->setTracer(fileTracer.data());
+    stateMachine->submitEvent("e2");
+    QVERIFY(stableStateSpy.wait(SpyWaitTime));
+    stateMachine->setTracer(Q_NULLPTR);
+    fileTracer.reset();
+
+    QFile traceFile(traceFileName);
+    QVERIFY(traceFile.open(QIODevice::ReadOnly));
+    const QByteArray trace = traceFile.readAll();
+    QVERIFY(trace.startsWith("QSCXMLTR"));
+    QCOMPARE(trace.at(12), 'S');
+    QVERIFY(trace.contains('R'));
+}
+
+void tst_StateMachine::manualProcessing()
+{
+    QScopedPointer<QScxmlStateMachine> stateMachine(QScxmlStateMachine::fromFile(QString(":/tst_statemachine/submitevents.scxml")));
+    QVERIFY(!stateMachine.isNull());
+
+    stateMachine->setManualProcessing(true);
+    QVERIFY(stateMachine->isManualProcessing());
+
+    // Everything happens synchronously, without an event loop.
+    stateMachine->start();
+    QVERIFY(stateMachine->isRunning());
+    QCOMPARE(stateMachine->activeStateNames(), QStringList() << QLatin1String("s0"));
+
+    stateMachine->submitEvent("e1");
+    QCOMPARE(stateMachine->activeStateNames(), QStringList() << QLatin1String("s0"));
+    stateMachine->submitEvent("e2");
+    QCOMPARE(stateMachine->processEvents(1), 1);
+    QCOMPARE(stateMachine->activeStateNames(), QStringList() << QLatin1String("s1"));
+
+    stateMachine->submitEvent("e3");
+    QCOMPARE(stateMachine->processEvents(), 2);
+    QCOMPARE(stateMachine->activeStateNames(), QStringList() << QLatin1String("s3"));
+    QCOMPARE(stateMachine->processEvents(), 0);
+
+    stateMachine->stop();
+    QVERIFY(!stateMachine->isRunning());
+
+    // Events submitted from another thread are processed without an event loop, too.
+    stateMachine.reset(QScxmlStateMachine::fromFile(QString(":/tst_statemachine/submitevents.scxml")));
+    QVERIFY(!stateMachine.isNull());
+    stateMachine->setManualProcessing(true);
+    stateMachine->start();
+    QVERIFY(stateMachine->isRunning());
+
+    EventProducer producer(stateMachine.data(),
+                           QStringList() << QLatin1String("e1") << QLatin1String("e2") << QLatin1String("e3"));
+    producer.start();
+    QVERIFY(producer.wait());
+    QCOMPARE(stateMachine->processEvents(), 3);
+    QCOMPARE(stateMachine->activeStateNames(), QStringList() << QLatin1String("s3"));
+}
+
+void tst_StateMachine::manualProcessingDelayedEvents()
+{
+    QScopedPointer<QScxmlStateMachine> stateMachine(QScxmlStateMachine::fromFile(QString(":/tst_statemachine/eventoccurred.scxml")));
+    QVERIFY(!stateMachine.isNull());
+
+    ManualClock clock;
+    stateMachine->setManualProcessing(true);
+    stateMachine->setClock(&clock);
+    stateMachine->start();
+    stateMachine->processEvents();
+    QVERIFY(stateMachine->isActive(QLatin1String("a")));
+
+    clock.time = 999;
+    stateMachine->processEvents();
+    QVERIFY(stateMachine->isActive(QLatin1String("a")));
+
+    clock.time = 1000;
+    stateMachine->processEvents();
+    QVERIFY(stateMachine->isActive(QLatin1String("final")));
+}
+
+void tst_StateMachine::delayedEventsOfManyMachines()
+{
+    // The machines of a thread share one timer. Each one still gets its own events in time,
+    // also when others cancel theirs or go away.
+    QList<QScxmlStateMachine *> stateMachines;
+    for (int i = 0; i < 5; ++i) {
+        QScxmlStateMachine *stateMachine = QScxmlStateMachine::fromFile(QString(":/tst_statemachine/submitevents.scxml"));
+        QVERIFY(stateMachine);
+        stateMachine->setParent(this);
+        stateMachine->start();
+        stateMachines.append(stateMachine);
+    }
+    foreach (QScxmlStateMachine *stateMachine, stateMachines)
+        QTRY_VERIFY_WITH_TIMEOUT(stateMachine->isActive(QStringLiteral("s0")), SpyWaitTime);
+
+    for (int i = 0; i < stateMachines.size(); ++i) {
+        QScxmlEvent *event = new QScxmlEvent;
+        event->setName(QStringLiteral("e1"));
+        event->setSendId(QStringLiteral("send"));
+        event->setDelay(50 * (stateMachines.size() - i));
+        stateMachines.at(i)->submitEvent(event);
+    }
+    stateMachines.at(1)->cancelDelayedEvent(QStringLiteral("send"));
+    delete stateMachines.takeLast(); // had the earliest due time
+
+    QTRY_VERIFY_WITH_TIMEOUT(stateMachines.first()->isActive(QStringLiteral("s1")), SpyWaitTime);
+    QVERIFY(stateMachines.at(1)->isActive(QStringLiteral("s0")));
+    for (int i = 2; i < stateMachines.size(); ++i)
+        QVERIFY(stateMachines.at(i)->isActive(QStringLiteral("s1")));
+    qDeleteAll(stateMachines);
+}
+
+void tst_StateMachine::compiledChart()
+{
+    QScxmlCompiledChart chart = QScxmlCompiledChart::fromFile(QString(":/tst_statemachine/submitevents.scxml"));
+    QVERIFY(chart.isValid());
+    QVERIFY(chart.parseErrors().isEmpty());
+    QCOMPARE(chart.name(), QLatin1String("SubmitEvents"));
+
+    QScopedPointer<QScxmlStateMachine> first(chart.instantiateStateMachine());
+    QScopedPointer<QScxmlStateMachine> second(chart.instantiateStateMachine());
+    QVERIFY(first->parseErrors().isEmpty());
+    QVERIFY(first->dataModel());
+    QVERIFY(second->dataModel());
+    QVERIFY(first->dataModel() != second->dataModel());
+    QCOMPARE(first->metaObject(), second->metaObject());
+
+    first->setManualProcessing(true);
+    second->setManualProcessing(true);
+    first->start();
+    second->start();
+
+    first->submitEvent("e1");
+    first->submitEvent("e2");
+    QCOMPARE(first->processEvents(), 2);
+    QCOMPARE(first->activeStateNames(), QStringList() << QLatin1String("s2"));
+    QCOMPARE(second->activeStateNames(), QStringList() << QLatin1String("s0"));
+
+    second->submitEvent("e1");
+    QCOMPARE(second->processEvents(), 1);
+    QCOMPARE(second->activeStateNames(), QStringList() << QLatin1String("s1"));
+
+    QScxmlCompiledChart invalid = QScxmlCompiledChart::fromFile(QString(":/tst_statemachine/nonexistent.scxml"));
+    QVERIFY(!invalid.isValid());
+    QCOMPARE(invalid.parseErrors().size(), 1);
+    QScopedPointer<QScxmlStateMachine> invalidMachine(invalid.instantiateStateMachine());
+    QCOMPARE(invalidMachine->parseErrors().size(), 1);
+}
+
+void tst_StateMachine::instantiateBenchmark_data()
+{
+    QTest::addColumn<bool>("compileOnce");
+
+    QTest::newRow("compile per instance") << false;
+    QTest::newRow("compiled chart") << true;
+}
+
+void tst_StateMachine::instantiateBenchmark()
+{
+    QFETCH(bool, compileOnce);
+
+    const QString fileName(QStringLiteral(":/tst_statemachine/invoke.scxml"));
+    QScxmlCompiledChart chart = QScxmlCompiledChart::fromFile(fileName);
+    QVERIFY(chart.isValid());
+
+    QBENCHMARK {
+        QScopedPointer<QScxmlStateMachine> stateMachine(
+                    compileOnce ? chart.instantiateStateMachine()
+                                : QScxmlStateMachine::fromFile(fileName));
+        QVERIFY(stateMachine->parseErrors().isEmpty());
+    }
+}
+
+void tst_StateMachine::instantiateMemory_data()
+{
+    instantiateBenchmark_data();
+}
+
+// Reports the heap memory that each instance keeps. A compiled chart shares its tables between the
+// instances, but each of them still gets its own tree of states and transitions and its own data
+// model.
+void tst_StateMachine::instantiateMemory()
+{
+#ifdef __GLIBC__
+    QFETCH(bool, compileOnce);
+
+    const QString fileName(QStringLiteral(":/tst_statemachine/invoke.scxml"));
+    QScxmlCompiledChart chart = QScxmlCompiledChart::fromFile(fileName);
+    QVERIFY(chart.isValid());
+    // The first instance sets up things that are shared by all of them, like meta objects.
+    delete QScxmlStateMachine::fromFile(fileName);
+    delete chart.instantiateStateMachine();
+
+    const int count = 100;
+    QVector<QScxmlStateMachine *> stateMachines;
+    stateMachines.reserve(count);
+    const int before = mallinfo().uordblks;
+    for (int i = 0; i < count; ++i) {
+        stateMachines.append(compileOnce ? chart.instantiateStateMachine()
+                                         : QScxmlStateMachine::fromFile(fileName));
+    }
+    const int after = mallinfo().uordblks;
+    qDeleteAll(stateMachines);
+
+    QTest::setBenchmarkResult(qreal(after - before) / count, QTest::BytesAllocated);
+#else
+    QSKIP("Measuring the heap needs mallinfo() from glibc.");
+#endif
+}
+
+void tst_StateMachine::invokeBenchmark()
+{
+    QScopedPointer<QScxmlStateMachine> stateMachine(QScxmlStateMachine::fromFile(QString(":/tst_statemachine/invoke.scxml")));
+    QVERIFY(!stateMachine.isNull());
+
+    QSignalSpy idleSpy(stateMachine.data(), SIGNAL(idleChanged(bool)));
+    stateMachine->start();
+    QVERIFY(idleSpy.wait(SpyWaitTime));
+    idleSpy.clear();
+
+    // Each iteration invokes a child machine, which finishes right away and sends the parent
+    // back to idle.
+    QBENCHMARK {
+        stateMachine->submitEvent("go");
+        while (idleSpy.count() < 2)
+            QVERIFY(idleSpy.wait(SpyWaitTime));
+        idleSpy.clear();
+    }
+    QVERIFY(stateMachine->isActive(QLatin1String("idle")));
+}
+
+void tst_StateMachine::invokePool()
+{
+    QScopedPointer<QScxmlStateMachine> stateMachine(QScxmlStateMachine::fromFile(QString(":/tst_statemachine/invoke.scxml")));
+    QVERIFY(!stateMachine.isNull());
+
+    QScxmlState *invoking = stateMachine->findChild<QScxmlState *>(QLatin1String("invoking"));
+    QVERIFY(invoking);
+    const QVector<QScxmlInvokableServiceFactory *> &factories
+            = QScxmlStatePrivate::get(invoking)->invokableServiceFactories;
+    QCOMPARE(factories.size(), 1);
+    QScxmlInvokableServiceFactory *factory = factories.first();
+    QCOMPARE(factory->poolSize(), 0);
+    factory->setPoolSize(1);
+    QCOMPARE(factory->poolSize(), 1);
+
+    QSignalSpy idleSpy(stateMachine.data(), SIGNAL(idleChanged(bool)));
+    QSignalSpy childSpy(stateMachine.data(), SIGNAL(ChildChanged(QScxmlStateMachine *)));
+    stateMachine->start();
+    QVERIFY(idleSpy.wait(SpyWaitTime));
+    idleSpy.clear();
+
+    QVector<QScxmlStateMachine *> children;
+    QStringList sessionIds;
+    for (int i = 0; i < 3; ++i) {
+        stateMachine->submitEvent("go");
+        while (idleSpy.count() < 2)
+            QVERIFY(idleSpy.wait(SpyWaitTime));
+        idleSpy.clear();
+
+        // The service is added on entry, and removed some time after leaving the state.
+        while (childSpy.count() < 2)
+            QVERIFY(childSpy.wait(SpyWaitTime));
+        QVERIFY(!qvariant_cast<QScxmlStateMachine *>(childSpy.at(1).at(0)));
+        QScxmlStateMachine *child = qvariant_cast<QScxmlStateMachine *>(childSpy.first().at(0));
+        QVERIFY(child);
+        children.append(child);
+        childSpy.clear();
+    }
+
+    // The child of the first invocation is reset and used for the following ones.
+    QCOMPARE(children.at(1), children.at(0));
+    QCOMPARE(children.at(2), children.at(0));
+    QVERIFY(!children.at(0)->isInitialized());
+    QVERIFY(!children.at(0)->isRunning());
+}
+
+void tst_StateMachine::invokePoolCanceled()
+{
+    QScopedPointer<QScxmlStateMachine> stateMachine(QScxmlStateMachine::fromFile(QString(":/tst_statemachine/invokecancel.scxml")));
+    QVERIFY(!stateMachine.isNull());
+
+    QScxmlState *invoking = stateMachine->findChild<QScxmlState *>(QLatin1String("invoking"));
+    QVERIFY(invoking);
+    QScxmlInvokableServiceFactory *factory
+            = QScxmlStatePrivate::get(invoking)->invokableServiceFactories.first();
+    factory->setPoolSize(1);
+
+    QSignalSpy idleSpy(stateMachine.data(), SIGNAL(idleChanged(bool)));
+    QSignalSpy childSpy(stateMachine.data(), SIGNAL(ChildChanged(QScxmlStateMachine *)));
+    stateMachine->start();
+    QVERIFY(idleSpy.wait(SpyWaitTime));
+    idleSpy.clear();
+
+    QVector<QScxmlStateMachine *> children;
+    for (int i = 0; i < 3; ++i) {
+        stateMachine->submitEvent("go");
+        while (childSpy.count() < 1)
+            QVERIFY(childSpy.wait(SpyWaitTime));
+        QScxmlStateMachine *child = qvariant_cast<QScxmlStateMachine *>(childSpy.first().at(0));
+        QVERIFY(child);
+        QTRY_VERIFY(child->isRunning());
+        QVERIFY(child->isActive(QLatin1String("waiting")));
+
+        // Leave the invoking state while the child still waits for "finish".
+        stateMachine->submitEvent("leave");
+        while (childSpy.count() < 2)
+            QVERIFY(childSpy.wait(SpyWaitTime));
+        QVERIFY(!qvariant_cast<QScxmlStateMachine *>(childSpy.at(1).at(0)));
+        QVERIFY(stateMachine->isActive(QLatin1String("idle")));
+        children.append(child);
+        childSpy.clear();
+    }
+
+    // The canceled child is stopped, reset and used for the following invocations. Its onexit
+    // handler does not reach the parent anymore.
+    QCOMPARE(children.at(1), children.at(0));
+    QCOMPARE(children.at(2), children.at(0));
+    QVERIFY(!children.at(0)->isInitialized());
+    QVERIFY(!children.at(0)->isRunning());
+    QCoreApplication::processEvents();
+    QVERIFY(stateMachine->isActive(QLatin1String("idle")));
+}
+
+void tst_StateMachine::invokeThreaded()
+{
+    QScopedPointer<QScxmlStateMachine> stateMachine(QScxmlStateMachine::fromFile(QString(":/tst_statemachine/invoke.scxml")));
+    QVERIFY(!stateMachine.isNull());
+
+    QScxmlState *invoking = stateMachine->findChild<QScxmlState *>(QLatin1String("invoking"));
+    QVERIFY(invoking);
+    auto factory = dynamic_cast<QScxmlInvokableScxmlServiceFactory *>(
+                QScxmlStatePrivate::get(invoking)->invokableServiceFactories.first());
+    QVERIFY(factory);
+    QVERIFY(!factory->isThreaded());
+    factory->setThreaded(true);
+    QVERIFY(factory->isThreaded());
+
+    ChildThreadRecorder recorder;
+    QVERIFY(QObject::connect(stateMachine.data(), SIGNAL(ChildChanged(QScxmlStateMachine *)),
+                             &recorder, SLOT(childChanged(QScxmlStateMachine *))));
+
+    QSignalSpy idleSpy(stateMachine.data(), SIGNAL(idleChanged(bool)));
+    stateMachine->start();
+    QVERIFY(idleSpy.wait(SpyWaitTime));
+    idleSpy.clear();
+
+    // The children run their own event loops and report back with done.invoke.
+    for (int i = 0; i < 3; ++i) {
+        stateMachine->submitEvent("go");
+        while (idleSpy.count() < 2)
+            QVERIFY(idleSpy.wait(SpyWaitTime));
+        QVERIFY(idleSpy.at(1).at(0).toBool());
+        idleSpy.clear();
+    }
+
+    QCOMPARE(recorder.threads.size(), 3);
+    foreach (QThread *thread, recorder.threads) {
+        QVERIFY(thread != stateMachine->thread());
+        QVERIFY(thread->objectName().startsWith(QStringLiteral("QScxmlWorker")));
+    }
+}
+
+void tst_StateMachine::executor()
+{
+    QScxmlExecutor executor(2);
+    QCOMPARE(executor.threadCount(), 2);
+
+    QScxmlCompiledChart chart = QScxmlCompiledChart::fromFile(QString(":/tst_statemachine/invokeroute.scxml"));
+    QVERIFY(chart.isValid());
+
+    // The signals are emitted in the worker threads, and queued to this one.
+    int stableCount = 0;
+    int finishedCount = 0;
+    QVector<QScxmlStateMachine *> stateMachines;
+    for (int i = 0; i < 8; ++i) {
+        QScxmlStateMachine *stateMachine = chart.instantiateStateMachine();
+        QVERIFY(stateMachine);
+        connect(stateMachine, &QScxmlStateMachine::reachedStableState, this,
+                [&stableCount]() { ++stableCount; });
+        connect(stateMachine, &QScxmlStateMachine::finished, this,
+                [&finishedCount]() { ++finishedCount; });
+        QVERIFY(executor.start(stateMachine));
+        QCOMPARE(stateMachine->thread(), executor.threadForSession(stateMachine->sessionId()));
+        QVERIFY(stateMachine->thread() != thread());
+        stateMachines.append(stateMachine);
+    }
+    QCOMPARE(executor.stateMachines(), stateMachines);
+
+    QTRY_COMPARE_WITH_TIMEOUT(stableCount, stateMachines.size(), SpyWaitTime);
+    foreach (QScxmlStateMachine *stateMachine, stateMachines)
+        stateMachine->submitEvent("go");
+    QTRY_COMPARE_WITH_TIMEOUT(finishedCount, stateMachines.size(), SpyWaitTime);
+
+    // Deleting a state machine in its worker thread removes it from the executor.
+    stateMachines.first()->deleteLater();
+    QTRY_COMPARE_WITH_TIMEOUT(executor.stateMachines().size(), stateMachines.size() - 1, SpyWaitTime);
+}
+
+void tst_StateMachine::executorSharedThreads()
+{
+    QPointer<QScxmlStateMachine> stateMachine;
+    {
+        QScxmlExecutor executor;
+        QCOMPARE(executor.threadCount(), qMax(QThread::idealThreadCount(), 1));
+
+        stateMachine = QScxmlStateMachine::fromFile(QString(":/tst_statemachine/invokeroute.scxml"));
+        QVERIFY(stateMachine);
+        QVERIFY(executor.addStateMachine(stateMachine));
+        // The threads of a default executor are the ones threaded <invoke>s run in.
+        QVERIFY(stateMachine->thread()->objectName().startsWith(QStringLiteral("QScxmlWorker")));
+
+        // Events submitted before the start are processed once the state machine has started.
+        bool finished = false;
+        connect(stateMachine.data(), &QScxmlStateMachine::finished, this,
+                [&finished]() { finished = true; });
+        stateMachine->submitEvent("go");
+        QVERIFY(executor.start(stateMachine));
+        QTRY_VERIFY_WITH_TIMEOUT(finished, SpyWaitTime);
+    }
+
+    // The executor waits for the worker thread to delete the state machines it still runs.
+    QVERIFY(stateMachine.isNull());
+}
+
+void tst_StateMachine::routeToInvokedService()
+{
+    QScopedPointer<QScxmlStateMachine> stateMachine(QScxmlStateMachine::fromFile(QString(":/tst_statemachine/invokeroute.scxml")));
+    QVERIFY(!stateMachine.isNull());
+
+    QSignalSpy stableStateSpy(stateMachine.data(), SIGNAL(reachedStableState()));
+    QSignalSpy finishedSpy(stateMachine.data(), SIGNAL(finished()));
+
+    stateMachine->start();
+    QVERIFY(stableStateSpy.wait(SpyWaitTime));
+    QVERIFY(stateMachine->isDispatchableTarget(QLatin1String("#_worker")));
+    QVERIFY(!stateMachine->isDispatchableTarget(QLatin1String("#_nobody")));
+
+    stateMachine->submitEvent("go");
+    QVERIFY(finishedSpy.wait(SpyWaitTime));
+    QVERIFY(stateMachine->isActive(QLatin1String("finished")));
+}
+
 void tst_StateMachine::doneDotStateEvent()
 {
     QScopedPointer<QScxmlStateMachine> stateMachine(QScxmlStateMachine::fromFile(QString(":/tst_statemachine/stateDotDoneEvent.scxml")));
@@ -176,6 +825,170 @@ void tst_StateMachine::doneDotStateEvent()
     QVERIFY(stateMachine->activeStateNames(true).contains(QLatin1String("success")));
 }
 
+void tst_StateMachine::nestedIfElse()
+{
+    QScopedPointer<QScxmlStateMachine> stateMachine(QScxmlStateMachine::fromFile(QString(":/tst_statemachine/ifelse.scxml")));
+    QVERIFY(!stateMachine.isNull());
+    QCOMPARE(stateMachine->parseErrors().count(), 0);
+
+    QSignalSpy stableStateSpy(stateMachine.data(), SIGNAL(reachedStableState()));
+    stateMachine->start();
+    QVERIFY(stableStateSpy.wait(SpyWaitTime));
+
+    // The instructions after a nested block, and after the <if>, run as well.
+    QVERIFY(stateMachine->isActive(QStringLiteral("pass")));
+}
+
+void tst_StateMachine::profileEvaluators()
+{
+    QScopedPointer<QScxmlStateMachine> stateMachine(QScxmlStateMachine::fromFile(QString(":/tst_statemachine/ifelse.scxml")));
+    QVERIFY(!stateMachine.isNull());
+    QScxmlDataModel *dataModel = stateMachine->dataModel();
+    QVERIFY(dataModel);
+    QVERIFY(!dataModel->isProfiling());
+    dataModel->setProfiling(true);
+    QVERIFY(dataModel->isProfiling());
+
+    QSignalSpy stableStateSpy(stateMachine.data(), SIGNAL(reachedStableState()));
+    stateMachine->start();
+    QVERIFY(stableStateSpy.wait(SpyWaitTime));
+    QVERIFY(stateMachine->isActive(QStringLiteral("pass")));
+
+    int assignments = 0;
+    int conditions = 0;
+    foreach (const QScxmlDataModel::ProfileEntry &entry, dataModel->profile()) {
+        QVERIFY(entry.callCount > 0);
+        QCOMPARE(entry.failureCount, qint64(0));
+        QVERIFY(entry.maxNanoseconds <= entry.totalNanoseconds);
+        if (entry.kind == QScxmlDataModel::AssignmentProfile)
+            assignments += entry.callCount;
+        else if (entry.kind == QScxmlDataModel::EvaluatorProfile)
+            conditions += entry.callCount;
+    }
+    // Six <assign>s ran; the four <if> conditions and at least one guard were evaluated.
+    QCOMPARE(assignments, 6);
+    QVERIFY(conditions >= 5);
+
+    const QByteArray json = dataModel->profileToJson();
+    QVERIFY(json.contains("x == 3"));
+    QVERIFY(json.contains("\"context\""));
+
+    dataModel->clearProfile();
+    QVERIFY(dataModel->isProfiling());
+    QVERIFY(dataModel->profile().isEmpty());
+    dataModel->setProfiling(false);
+    QVERIFY(!dataModel->isProfiling());
+}
+
+void tst_StateMachine::eventDataPerEvent()
+{
+    QScopedPointer<QScxmlStateMachine> stateMachine(QScxmlStateMachine::fromFile(QString(":/tst_statemachine/eventdata.scxml")));
+    QVERIFY(!stateMachine.isNull());
+    QCOMPARE(stateMachine->parseErrors().count(), 0);
+
+    QSignalSpy stableStateSpy(stateMachine.data(), SIGNAL(reachedStableState()));
+    stateMachine->start();
+    QVERIFY(stableStateSpy.wait(SpyWaitTime));
+
+    QVariantMap data;
+    data.insert(QStringLiteral("n"), 1);
+    stateMachine->submitEvent(QStringLiteral("e"), data);
+    QVERIFY(stableStateSpy.wait(SpyWaitTime));
+    QVERIFY(stateMachine->isActive(QStringLiteral("b")));
+
+    data.insert(QStringLiteral("n"), 2);
+    stateMachine->submitEvent(QStringLiteral("e"), data);
+    QVERIFY(stableStateSpy.wait(SpyWaitTime));
+    QVERIFY(stateMachine->isActive(QStringLiteral("pass")));
+}
+
+void tst_StateMachine::jsonDataParsing_data()
+{
+    QTest::addColumn<int>("parsing");
+    QTest::addColumn<bool>("marked");
+    QTest::addColumn<QString>("expectedState");
+
+    QTest::newRow("all") << int(QScxmlStateMachine::ParseAllJsonData) << false << QString("parsed");
+    QTest::newRow("none") << int(QScxmlStateMachine::ParseNoJsonData) << true << QString("text");
+    QTest::newRow("unmarked") << int(QScxmlStateMachine::ParseMarkedJsonData) << false << QString("text");
+    QTest::newRow("marked") << int(QScxmlStateMachine::ParseMarkedJsonData) << true << QString("parsed");
+}
+
+void tst_StateMachine::jsonDataParsing()
+{
+    QFETCH(int, parsing);
+    QFETCH(bool, marked);
+    QFETCH(QString, expectedState);
+
+    QScopedPointer<QScxmlStateMachine> stateMachine(QScxmlStateMachine::fromFile(QString(":/tst_statemachine/jsondata.scxml")));
+    QVERIFY(!stateMachine.isNull());
+    QCOMPARE(stateMachine->jsonDataParsing(), QScxmlStateMachine::ParseAllJsonData);
+    stateMachine->setJsonDataParsing(QScxmlStateMachine::JsonDataParsing(parsing));
+
+    QSignalSpy stableStateSpy(stateMachine.data(), SIGNAL(reachedStableState()));
+    stateMachine->start();
+    QVERIFY(stableStateSpy.wait(SpyWaitTime));
+
+    QScxmlEvent *event = new QScxmlEvent;
+    event->setName(QStringLiteral("e"));
+    event->setData(QStringLiteral(" {\"n\": 1}"));
+    event->setJsonData(marked);
+    stateMachine->submitEvent(event);
+    QVERIFY(stableStateSpy.wait(SpyWaitTime));
+    QVERIFY(stateMachine->isActive(expectedState));
+}
+
+void tst_StateMachine::assignments()
+{
+    QScopedPointer<QScxmlStateMachine> stateMachine(QScxmlStateMachine::fromFile(QString(":/tst_statemachine/assignments.scxml")));
+    QVERIFY(!stateMachine.isNull());
+    QCOMPARE(stateMachine->parseErrors().count(), 0);
+
+    QSignalSpy stableStateSpy(stateMachine.data(), SIGNAL(reachedStableState()));
+    stateMachine->start();
+    QVERIFY(stableStateSpy.wait(SpyWaitTime));
+    QVERIFY(stateMachine->isActive(QStringLiteral("pass")));
+
+    QScxmlDataModel *dataModel = stateMachine->dataModel();
+    QVERIFY(dataModel->hasScxmlProperty(QStringLiteral("x")));
+    QCOMPARE(dataModel->scxmlProperty(QStringLiteral("x")).toInt(), 120);
+    QVERIFY(dataModel->setScxmlProperty(QStringLiteral("x"), 5, QStringLiteral("test")));
+    QCOMPARE(dataModel->scxmlProperty(QStringLiteral("x")).toInt(), 5);
+    QVERIFY(!dataModel->setScxmlProperty(QStringLiteral("_name"), 5, QStringLiteral("test")));
+
+    // Looking up a variable before it exists must not hide it later on.
+    QScxmlEcmaScriptDataModel *ecmaScriptDataModel = qobject_cast<QScxmlEcmaScriptDataModel *>(dataModel);
+    QVERIFY(ecmaScriptDataModel);
+    QVERIFY(!dataModel->hasScxmlProperty(QStringLiteral("w")));
+    ecmaScriptDataModel->engine()->evaluate(QStringLiteral("var w = 7"));
+    QVERIFY(dataModel->hasScxmlProperty(QStringLiteral("w")));
+    QCOMPARE(dataModel->scxmlProperty(QStringLiteral("w")).toInt(), 7);
+}
+
+void tst_StateMachine::foreachLargeArray()
+{
+    QScopedPointer<QScxmlStateMachine> stateMachine(QScxmlStateMachine::fromFile(QString(":/tst_statemachine/foreachlarge.scxml")));
+    QVERIFY(!stateMachine.isNull());
+    QCOMPARE(stateMachine->parseErrors().count(), 0);
+
+    QSignalSpy stableStateSpy(stateMachine.data(), SIGNAL(reachedStableState()));
+    stateMachine->start();
+    QVERIFY(stableStateSpy.wait(SpyWaitTime));
+    QVERIFY(stateMachine->isActive(QStringLiteral("pass")));
+}
+
+void tst_StateMachine::scriptsRunEveryTime()
+{
+    QScopedPointer<QScxmlStateMachine> stateMachine(QScxmlStateMachine::fromFile(QString(":/tst_statemachine/scripts.scxml")));
+    QVERIFY(!stateMachine.isNull());
+    QCOMPARE(stateMachine->parseErrors().count(), 0);
+
+    QSignalSpy stableStateSpy(stateMachine.data(), SIGNAL(reachedStableState()));
+    stateMachine->start();
+    QVERIFY(stableStateSpy.wait(SpyWaitTime));
+    QVERIFY(stateMachine->isActive(QStringLiteral("pass")));
+    QCOMPARE(stateMachine->dataModel()->scxmlProperty(QStringLiteral("errors")).toInt(), 3);
+}
 
 QTEST_MAIN(tst_StateMachine)
 